@@ -12,323 +12,6873 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <ctype.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
 #include <csignal>
 #include <iostream>
 #include <chrono>
 #include <cstdlib>
+#include <cstdint>
 #include <sstream>
+#include <fstream>
 #include <vector>
+#include <deque>
+#include <functional>
+#include <algorithm>
+#include <map>
+#include <unordered_set>
+#include <memory>
+#include <new>
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <sys/epoll.h>
+#include <sys/prctl.h>
+
+// io_uring needs its header (Linux 5.1+); the calls themselves are made through syscall()
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define HAVE_IO_URING 1
+#endif
+#endif
+#endif
 
 using namespace std;
 
-// a simple program to function similar to "grep" command
-class CustomGrep
+/*
+    Record format of the listing
+
+    the listing travels between the processes as a sequence of binary records, one per file:
+
+        [length: 2 bytes][type: 1 byte][flags: 1 byte][optional fields][name: "length" bytes]
+
+    - the name is the path of the file, relative to the listed directory, and may hold any byte (a comma too)
+    - the type is the "d_type" of the file (DT_REG, DT_DIR, DT_LNK, ...)
+    - the flags tell which optional fields follow, in this order: the inode (8 bytes), the size (8 bytes),
+      the id of the directory the file is in (4 bytes), and, for a directory, its own id (4 bytes)
+    - the fields are kept in the native byte order, and read with memcpy, so a record needs no alignment
+
+    a record is parsed where it lies, into a Record that points at its name, so reading one allocates nothing
+*/
+const uint8_t RECORD_INODE = 1;
+const uint8_t RECORD_SIZE = 2;
+const uint8_t RECORD_PARENT = 4;
+const uint8_t RECORD_DIRECTORY_ID = 8;
+
+struct Record
 {
-private:
-    static string seeking_file;
+    const char *name;
+    size_t length;
+    unsigned char type;
+    uint8_t flags;
+    uint64_t inode;
+    uint64_t size;
+    uint32_t parent;
+    uint32_t directory_id;
+};
 
-public:
-    CustomGrep() = default;
+const size_t RECORD_HEADER_SIZE = 4;
 
-    CustomGrep(string file)
+// the bytes of the optional fields that "flags" asks for
+size_t record_fields_size(uint8_t flags)
+{
+    return (flags & RECORD_INODE ? 8 : 0) + (flags & RECORD_SIZE ? 8 : 0) +
+           (flags & RECORD_PARENT ? 4 : 0) + (flags & RECORD_DIRECTORY_ID ? 4 : 0);
+}
+
+// the longest name a record holds, and so the largest record
+const size_t MAX_RECORD_NAME = UINT16_MAX;
+const size_t MAX_RECORD_SIZE = RECORD_HEADER_SIZE + 24 + MAX_RECORD_NAME;
+
+/*
+    append a record to "out", named "prefix" followed by "record.name"
+    return false, appending nothing, if the name is longer than a record holds
+*/
+bool append_record(string &out, const Record &record, const char *prefix, size_t prefix_length)
+{
+    if (prefix_length + record.length > MAX_RECORD_NAME)
     {
-        seeking_file = file;
+        return false;
     }
 
-    // a simple custom "grep" function that identifies a file(s), whose name contains "text", from processed output of "ls -R ~/[path]" command
-    static void custom_grep(string files)
+    uint16_t length = prefix_length + record.length;
+    char header[RECORD_HEADER_SIZE + 24];
+    char *field = header + RECORD_HEADER_SIZE;
+
+    memcpy(header, &length, sizeof(length));
+    header[2] = record.type;
+    header[3] = record.flags;
+
+    if (record.flags & RECORD_INODE)
+    {
+        memcpy(field, &record.inode, 8);
+        field += 8;
+    }
+    if (record.flags & RECORD_SIZE)
+    {
+        memcpy(field, &record.size, 8);
+        field += 8;
+    }
+    if (record.flags & RECORD_PARENT)
+    {
+        memcpy(field, &record.parent, 4);
+        field += 4;
+    }
+    if (record.flags & RECORD_DIRECTORY_ID)
     {
-        string file;
-        char delimiter = ',';
-        stringstream stream(files);
-        vector<string> sought_files;
+        memcpy(field, &record.directory_id, 4);
+        field += 4;
+    }
 
-        // separate files by comma (,) to store each individual file into a vector
-        while (getline(stream, file, delimiter))
-        {
-            // IF the seeking data is a substring of or equal to files, THEN store it into a vector
-            if (file.find(seeking_file) != string::npos)
-            {
-                sought_files.push_back(file);
-            }
-        }
+    out.append(header, field - header);
+    out.append(prefix, prefix_length);
+    out.append(record.name, record.length);
+    return true;
+}
 
-        // IF nothing is found, THEN terminate the program
-        if (sought_files.size() == 0)
-        {
-            cout << "\nFile does not found\n"
-                 << endl;
-            return;
-        }
+// tell that an entry under "prefix" is left out: its path (which may go deeper than PATH_MAX) does not fit in a record
+void report_long_path(const string &prefix, size_t length)
+{
+    fprintf(stderr, "Path Too Long: skipped \"%.64s...\" (%zu bytes), longer than a record holds (%zu bytes)\n",
+            prefix.c_str(), prefix.size() + length, MAX_RECORD_NAME);
+}
 
-        cout << "\nRESULT:\n"
-             << endl;
+/*
+    parse the record at "position", in a buffer ending at "end"
+    return where the next record starts, or nullptr if the record is cut short
+*/
+const char *read_record(const char *position, const char *end, Record &record)
+{
+    if (size_t(end - position) < RECORD_HEADER_SIZE)
+    {
+        return nullptr;
+    }
 
-        // display identified file and directory
-        for (string file : sought_files)
-        {
-            cout << file << endl;
-        }
+    uint16_t length;
+    memcpy(&length, position, sizeof(length));
+    record.type = position[2];
+    record.flags = position[3];
 
-        // break a new line
-        cout << "\n"
-             << endl;
+    const char *field = position + RECORD_HEADER_SIZE;
+    const char *name = field + record_fields_size(record.flags);
+    if (name > end || size_t(end - name) < length)
+    {
+        return nullptr;
     }
-};
+
+    record.inode = 0;
+    record.size = 0;
+    record.parent = 0;
+    record.directory_id = 0;
+
+    if (record.flags & RECORD_INODE)
+    {
+        memcpy(&record.inode, field, 8);
+        field += 8;
+    }
+    if (record.flags & RECORD_SIZE)
+    {
+        memcpy(&record.size, field, 8);
+        field += 8;
+    }
+    if (record.flags & RECORD_PARENT)
+    {
+        memcpy(&record.parent, field, 4);
+        field += 4;
+    }
+    if (record.flags & RECORD_DIRECTORY_ID)
+    {
+        memcpy(&record.directory_id, field, 4);
+    }
+
+    record.name = name;
+    record.length = length;
+
+    return name + length;
+}
 
 /*
-    Adapted from: "Execute a command and get both output and exit status in C++ (Windows & Linux)" by Remy van Elst,
-                    07-06-2021, https://raymii.org/s/articles/Execute_a_command_and_get_both_output_and_exit_code.html
-    Modified the function to be suitable for this project
+    Substring search kernels
 
-    return the processed output of "ls ~/[path]" command
+    find_substring returns the first occurrence of a needle in a buffer, or nullptr
+    it is picked once at start-up, after the features of the CPU:
+    - AVX2 / SSE2: compare 32 / 16 positions at a time against the first and the last byte of the needle,
+      and check the middle of the needle only at the positions where both match (few, for a file name)
+    - scalar: memchr for the first byte, then the same checks, for any other CPU
 */
-string process_ls_output(string command, int BUFFER_SIZE)
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define IPC_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+typedef const char *(*SubstringKernel)(const char *begin, const char *end, const char *needle, size_t needle_length);
+
+const char *find_substring_scalar(const char *begin, const char *end, const char *needle, size_t needle_length)
 {
-    /*
-        popen function creates a pipe and executes a shell command within the process
-        for a mode "r", read the output from the command
-    */
-    FILE *pipe = popen(command.c_str(), "r");
-    char buffer[BUFFER_SIZE];
-    string output = "";
+    if (needle_length == 0)
+    {
+        return begin;
+    }
+    // a haystack shorter than the needle holds none (and "limit" would point before "begin")
+    if (size_t(end - begin) < needle_length)
+    {
+        return nullptr;
+    }
 
-    if (!pipe)
+    const char *limit = end - needle_length + 1;
+    const char *position = begin;
+
+    while (position < limit)
     {
-        fprintf(stderr, "Failed to execute the command\n");
-        exit(0);
+        position = static_cast<const char *>(memchr(position, needle[0], limit - position));
+        if (!position)
+        {
+            return nullptr;
+        }
+
+        if (position[needle_length - 1] == needle[needle_length - 1] &&
+            memcmp(position + 1, needle + 1, needle_length - 1) == 0)
+        {
+            return position;
+        }
+
+        position++;
     }
 
-    while (fgets(buffer, BUFFER_SIZE, pipe) != nullptr)
+    return nullptr;
+}
+
+#ifdef IPC_X86_SIMD
+__attribute__((target("sse2"))) const char *find_substring_sse2(const char *begin, const char *end, const char *needle, size_t needle_length)
+{
+    if (needle_length < 2 || size_t(end - begin) < needle_length)
     {
-        output += buffer;
+        return needle_length == 0 ? begin : find_substring_scalar(begin, end, needle, needle_length);
     }
 
-    pclose(pipe);
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[needle_length - 1]);
 
-    string files;
-    stringstream processed(output);
-    string file;
+    // a block of candidates starting at "position" reads up to "position + 16 + needle_length - 1"
+    const char *limit = end - needle_length + 1;
+    const char *position = begin;
 
-    while (getline(processed, file))
+    for (; position + 16 <= limit; position += 16)
     {
-        files += file + ",";
+        __m128i block_first = _mm_loadu_si128(reinterpret_cast<const __m128i *>(position));
+        __m128i block_last = _mm_loadu_si128(reinterpret_cast<const __m128i *>(position + needle_length - 1));
+
+        unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, block_first), _mm_cmpeq_epi8(last, block_last)));
+
+        while (mask != 0)
+        {
+            int bit = __builtin_ctz(mask);
+            if (memcmp(position + bit + 1, needle + 1, needle_length - 2) == 0)
+            {
+                return position + bit;
+            }
+            mask &= mask - 1;
+        }
     }
 
-    return files;
+    return find_substring_scalar(position, end, needle, needle_length);
 }
 
-/* IPC implementation using a pipe (|) */
+__attribute__((target("avx2"))) const char *find_substring_avx2(const char *begin, const char *end, const char *needle, size_t needle_length)
+{
+    if (needle_length < 2 || size_t(end - begin) < needle_length)
+    {
+        return needle_length == 0 ? begin : find_substring_scalar(begin, end, needle, needle_length);
+    }
 
-const int BUFFER_SIZE = 4096;
-const int READ_END = 0;
-const int WRITE_END = 1;
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[needle_length - 1]);
+
+    // a block of candidates starting at "position" reads up to "position + 32 + needle_length - 1"
+    const char *limit = end - needle_length + 1;
+    const char *position = begin;
+
+    for (; position + 32 <= limit; position += 32)
+    {
+        __m256i block_first = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(position));
+        __m256i block_last = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(position + needle_length - 1));
+
+        unsigned int mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(first, block_first), _mm256_cmpeq_epi8(last, block_last)));
+
+        while (mask != 0)
+        {
+            int bit = __builtin_ctz(mask);
+            if (memcmp(position + bit + 1, needle + 1, needle_length - 2) == 0)
+            {
+                return position + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
 
-// collect a start time for the program
-auto time_start = chrono::high_resolution_clock::now();
+    // finish the last partial block with SSE2, then scalar
+    return find_substring_sse2(position, end, needle, needle_length);
+}
+#endif
 
-// implement Ordinary Pipe and Producer-Consumer pattern
-void pipeline(string parent_process, CustomGrep child_process)
+// pick the fastest kernel the CPU supports
+SubstringKernel select_substring_kernel()
 {
-    // parent process produces an output by executing "ls ~/[path]" command
-    string output = process_ls_output(parent_process.c_str(), BUFFER_SIZE);
+#ifdef IPC_X86_SIMD
+    __builtin_cpu_init();
 
-    // IF the size of the output exceeds the buffer size, THEN terminate the program
-    if (output.length() > BUFFER_SIZE)
+    if (__builtin_cpu_supports("avx2"))
     {
-        fprintf(stderr, "\nERROR: Buffer Overflow\n");
-        return;
+        return find_substring_avx2;
+    }
+    if (__builtin_cpu_supports("sse2"))
+    {
+        return find_substring_sse2;
     }
+#endif
+    return find_substring_scalar;
+}
 
-    // SIGPIE: a signal, which notifies a process that the pipe it is attempting to write to is closed
-    // It terminates the process by default, since this occurrence may be considered as a broken pipe
-    // To gracefully handle such error, first ignore the SIGPIE
-    signal(SIGPIPE, SIG_IGN);
+const SubstringKernel find_substring = select_substring_kernel();
 
-    char write_msg[BUFFER_SIZE];
-    char read_msg[BUFFER_SIZE];
+/*
+    PatternMatcher class matches a set of patterns against a listing, in a single pass over it
 
-    strcpy(write_msg, output.c_str());
+    a pattern is either:
+    - a literal, found as a substring of a path (as a single seeking file always was)
+    - a shell-style glob ("*", "?", "[abc]", "[!a-z]", "\" to escape), matched against the name after the last slash (/),
+      as "find -name" does
 
-    // file descriptors (have a parent-child relationship)
-    // - write by the parent to its write end of the pipe: fd[1]
-    // - read by the child from its read end of the pipe: fd[0]
-    int fd[2];
+    the literals are compiled into an Aho-Corasick automaton: a trie of the literals, where every state
+    also knows where to continue on a mismatch, so every literal is found by a single step per byte
+    the globs are compiled into a DFA, built lazily: a state of the DFA is the set of positions in the globs
+    that the name read so far can be at, and a transition is computed the first time it is taken, then cached
 
-    // create the pipe
-    if (pipe(fd) == -1)
-    {
-        fprintf(stderr, "\nPipe Creation Failed\n");
-        return;
-    }
+    both automata are stepped over every byte of a file, side by side, and every hit carries the id of its pattern
+*/
+class PatternMatcher
+{
+private:
+    vector<string> patterns;
 
-    // fork a child process
-    pid_t pid = fork();
+    /* Aho-Corasick automaton over the literals */
 
-    // IF failed to create a child process, THEN terminate the program
-    if (pid < 0)
-    {
-        fprintf(stderr, "\nFork Failed\n");
-        return;
-    }
+    // bytes that appear in no literal share class 0, so a state needs a transition per class rather than per byte
+    unsigned char byte_class[256];
+    int class_count = 1;
 
-    /* Parent process (Producer)*/
-    if (pid > 0)
+    vector<int> transitions;
+    vector<vector<uint32_t>> outputs;
+    // the next state down the failure links that has outputs, or -1
+    vector<int> output_link;
+    // literals that match every file (the empty literal)
+    vector<uint32_t> match_all;
+    bool has_literals = false;
+
+    /* lazy DFA over the globs */
+
+    // an item of a glob: the bytes it accepts, and whether it repeats ("*")
+    struct GlobItem
     {
-        printf("Parent Process PID: %d\n", getpid());
+        bool star;
+        bool bytes[256];
+    };
 
-        // close the un-used end of the pipe
-        close(fd[READ_END]);
+    // the items of every glob, one after another; a glob ends on an accepting position, with no item
+    vector<GlobItem> items;
+    vector<int> position_glob;
+    vector<bool> accepting_position;
+    vector<uint32_t> glob_pattern;
+    vector<uint32_t> glob_start;
 
-        // write to the pipe
-        ssize_t write_byte = write(fd[WRITE_END], write_msg, strlen(write_msg) + 1);
+    map<vector<uint32_t>, int> state_index;
+    vector<vector<uint32_t>> state_positions;
+    vector<vector<uint32_t>> state_accepts;
+    vector<int> state_transitions;
+    int start_state = -1;
 
-        // handle errors gracefully
-        if (write_byte == -1)
+    static const int DFA_STATE_LIMIT = 4096;
+
+    // the test of a character class named in a bracket expression (e.g. "alpha" in "[[:alpha:]]"), or nullptr
+    static int (*character_class(const string &name))(int)
+    {
+        static const struct
+        {
+            const char *name;
+            int (*test)(int);
+        } classes[] = {{"alnum", isalnum}, {"alpha", isalpha}, {"blank", isblank}, {"cntrl", iscntrl},
+                       {"digit", isdigit}, {"graph", isgraph}, {"lower", islower}, {"print", isprint},
+                       {"punct", ispunct}, {"space", isspace}, {"upper", isupper}, {"xdigit", isxdigit}};
+
+        for (const auto &entry : classes)
         {
-            // EPIPE: "broken pipe" error
-            if (errno == EPIPE)
+            if (name == entry.name)
             {
-                cerr << "\n\"BROKEN PIPE\" ERROR: " << strerror(errno) << endl;
-                return;
+                return entry.test;
             }
-            // EAGAIN: "resource temporarily unavailable" error
-            // it occurs when an operation is attempted on non-blocking object
-            else if (errno == EAGAIN)
+        }
+        return nullptr;
+    }
+
+    /*
+        parse the bracket expression opened at glob[start] into the bytes it accepts, by the rules of fnmatch:
+        - "!" (or "^") right after "[" negates the set
+        - "]" right after "[" (or "[!") is a member of the set, not its end
+        - "\" takes the next byte as it is, and "a-z" is a range of bytes
+        - "[:alpha:]" (or another class of <ctype.h>) adds the bytes of the class; an unknown class matches no byte
+
+        return the position of the closing "]", or string::npos when there is none: the "[" is then a plain byte
+    */
+    static size_t parse_bracket(const string &glob, size_t start, bool bytes[256])
+    {
+        size_t j = start + 1;
+        bool negated = j < glob.size() && (glob[j] == '!' || glob[j] == '^');
+        if (negated)
+        {
+            j++;
+        }
+
+        bool set[256] = {false};
+        bool unknown_class = false;
+        for (bool first = true; j < glob.size(); j++, first = false)
+        {
+            if (glob[j] == ']' && !first)
             {
-                cerr << "\n\"RESOURCE TEMPORARILY UNAVAILABLE\" ERROR: " << strerror(errno) << endl;
-                return;
+                break;
             }
-            // EINTR: "interrupted system call" error
-            else if (errno == EINTR)
+
+            if (glob[j] == '[' && j + 1 < glob.size() && glob[j + 1] == ':')
             {
-                cerr << "\n\"INTERRUPTED SYSTEM CALL\" ERROR: " << strerror(errno) << endl;
-                return;
+                size_t class_end = glob.find(":]", j + 2);
+                int (*test)(int) = class_end == string::npos ? nullptr : character_class(glob.substr(j + 2, class_end - j - 2));
+                if (class_end != string::npos)
+                {
+                    for (int byte = 0; test && byte < 256; byte++)
+                    {
+                        set[byte] = set[byte] || test(byte);
+                    }
+                    unknown_class = unknown_class || !test;
+                    j = class_end + 1;
+                    continue;
+                }
             }
-            // EBADF: "bad file descriptor" error
-            else if (errno == EBADF)
+
+            if (glob[j] == '\\' && j + 1 < glob.size())
             {
-                cerr << "\n\"BAD FILE DESCRIPTOR\" ERROR: " << strerror(errno) << endl;
-                return;
+                j++;
             }
-            // ENOMEM: "cannot allocate memory" error
-            else if (errno == ENOMEM)
+            unsigned char low = glob[j];
+            unsigned char high = low;
+
+            // a "-" before the closing "]" is a member, not a range
+            if (j + 2 < glob.size() && glob[j + 1] == '-' && glob[j + 2] != ']')
             {
-                cerr << "\n\"CANNOT ALLOCATE MEMORY\" ERROR: " << strerror(errno) << endl;
-                return;
+                j += 2;
+                if (glob[j] == '\\' && j + 1 < glob.size())
+                {
+                    j++;
+                }
+                high = glob[j];
             }
-            else
+            for (int byte = low; byte <= high; byte++)
             {
-                cerr << "\nERROR: " << strerror(errno) << endl;
-                return;
+                set[byte] = true;
             }
         }
 
-        printf("WRITE: %s\n\n", write_msg);
+        if (j >= glob.size())
+        {
+            return string::npos;
+        }
+
+        for (int byte = 0; byte < 256; byte++)
+        {
+            bytes[byte] = set[byte] != negated && !unknown_class;
+        }
+        // a wildcard does not cross a slash (/)
+        if (negated)
+        {
+            bytes[static_cast<unsigned char>('/')] = false;
+        }
 
-        // close the write end of the pipe
-        close(fd[WRITE_END]);
+        return j;
     }
-    /* Child process (Consumer)*/
-    else
-    {
-        printf("Child Process PID: %d\n", getpid());
-
-        // close the un-used end of the pipe
-        close(fd[WRITE_END]);
 
-        // read from the pipe
-        ssize_t read_byte = read(fd[READ_END], read_msg, BUFFER_SIZE);
+    // parse a glob into items
+    void add_glob(const string &glob, uint32_t id)
+    {
+        glob_pattern.push_back(id);
+        glob_start.push_back(items.size());
 
-        // handle errors gracefully
-        if (read_byte == -1)
+        for (size_t i = 0; i < glob.size(); i++)
         {
-            // EPIPE: "broken pipe" error
-            if (errno == EPIPE)
-            {
-                cerr << "\n\"BROKEN PIPE\" ERROR: " << strerror(errno) << endl;
-                return;
-            }
-            // EAGAIN: "resource temporarily unavailable" error
-            // it occurs when an operation is attempted on non-blocking object
-            else if (errno == EAGAIN)
-            {
-                cerr << "\n\"RESOURCE TEMPORARILY UNAVAILABLE\" ERROR: " << strerror(errno) << endl;
-                return;
-            }
-            // EINTR: "interrupted system call" error
-            else if (errno == EINTR)
+            size_t close;
+            GlobItem item;
+            item.star = false;
+            memset(item.bytes, 0, sizeof(item.bytes));
+
+            if (glob[i] == '*' || glob[i] == '?')
             {
-                cerr << "\n\"INTERRUPTED SYSTEM CALL\" ERROR: " << strerror(errno) << endl;
-                return;
+                // a wildcard does not cross a slash (/)
+                item.star = glob[i] == '*';
+                memset(item.bytes, 1, sizeof(item.bytes));
+                item.bytes[static_cast<unsigned char>('/')] = false;
             }
-            // EBADF: "bad file descriptor" error
-            else if (errno == EBADF)
+            else if (glob[i] == '[' && (close = parse_bracket(glob, i, item.bytes)) != string::npos)
             {
-                cerr << "\n\"BAD FILE DESCRIPTOR\" ERROR: " << strerror(errno) << endl;
-                return;
+                i = close;
             }
-            // ENOMEM: "cannot allocate memory" error
-            else if (errno == ENOMEM)
+            else if (glob[i] == '\\' && i + 1 == glob.size())
             {
-                cerr << "\n\"CANNOT ALLOCATE MEMORY\" ERROR: " << strerror(errno) << endl;
-                return;
+                // as for fnmatch, a glob ending on a lone "\" is malformed, and matches nothing
             }
             else
             {
-                cerr << "\nERROR: " << strerror(errno) << endl;
-                return;
+                if (glob[i] == '\\')
+                {
+                    i++;
+                }
+                item.bytes[static_cast<unsigned char>(glob[i])] = true;
             }
+
+            items.push_back(item);
+            position_glob.push_back(glob_pattern.size() - 1);
+            accepting_position.push_back(false);
         }
 
-        printf("READ: %s\n", read_msg);
+        // the accepting position after the last item
+        GlobItem end_item;
+        end_item.star = false;
+        memset(end_item.bytes, 0, sizeof(end_item.bytes));
+        items.push_back(end_item);
+        position_glob.push_back(glob_pattern.size() - 1);
+        accepting_position.push_back(true);
+    }
 
-        // close the read end of the pipe
-        close(fd[READ_END]);
+    // add every position reachable without reading a byte (a "*" may match nothing), then sort the set
+    void close_positions(vector<uint32_t> &positions) const
+    {
+        for (size_t i = 0; i < positions.size(); i++)
+        {
+            if (items[positions[i]].star)
+            {
+                positions.push_back(positions[i] + 1);
+            }
+        }
 
-        // collect a end time for the program
-        auto time_end = chrono::high_resolution_clock::now();
+        sort(positions.begin(), positions.end());
+        positions.erase(unique(positions.begin(), positions.end()), positions.end());
+    }
+
+    // return the DFA state for a set of positions, creating it if needed
+    int intern_state(const vector<uint32_t> &positions)
+    {
+        map<vector<uint32_t>, int>::iterator found = state_index.find(positions);
+        if (found != state_index.end())
+        {
+            return found->second;
+        }
 
-        // calculate estimated excution time for the program
-        auto execution_time = chrono::duration_cast<chrono::milliseconds>(time_end - time_start);
+        int state = state_positions.size();
+        state_index[positions] = state;
+        state_positions.push_back(positions);
+        state_transitions.resize(state_transitions.size() + 256, -1);
 
-        // display the estimated execution time
-        cout << "\nEstimated Data Transmission Time: " << execution_time.count() << " milliseconds (ms)\n"
-             << endl;
+        vector<uint32_t> accepts;
+        for (uint32_t position : positions)
+        {
+            if (accepting_position[position])
+            {
+                accepts.push_back(glob_pattern[position_glob[position]]);
+            }
+        }
+        state_accepts.push_back(accepts);
 
-        // child process produces an output with read message
-        child_process.custom_grep(read_msg);
+        return state;
     }
 
-    return;
-}
+    // drop every cached DFA state, once there are too many of them; keep "state" alive, and return its new number
+    int reset_states(int state)
+    {
+        vector<uint32_t> positions = state_positions[state];
 
-string CustomGrep::seeking_file;
+        state_index.clear();
+        state_positions.clear();
+        state_accepts.clear();
+        state_transitions.clear();
 
-// the main function to execute the program
-int main()
-{
+        start_state = intern_state(start_positions());
+        return intern_state(positions);
+    }
 
-    string directory;
+    vector<uint32_t> start_positions() const
+    {
+        vector<uint32_t> positions(glob_start.begin(), glob_start.end());
+        close_positions(positions);
+        return positions;
+    }
+
+    // the DFA state after reading "byte" in "state"
+    int step_glob(int state, unsigned char byte)
+    {
+        int next = state_transitions[state * 256 + byte];
+        if (next != -1)
+        {
+            return next;
+        }
+
+        if (int(state_positions.size()) >= DFA_STATE_LIMIT)
+        {
+            state = reset_states(state);
+        }
 
-    // prompt a name of a directory
-    cout << "\nThis pipeline is for two specific processes: \"ls\" and \"CustomGrep\".\n\nPlease type a name of a directory: ls ~/";
+        vector<uint32_t> positions;
+        for (uint32_t position : state_positions[state])
+        {
+            const GlobItem &item = items[position];
+            if (item.bytes[byte])
+            {
+                positions.push_back(item.star ? position : position + 1);
+            }
+        }
+        close_positions(positions);
 
-    cin >> directory;
+        next = intern_state(positions);
+        state_transitions[state * 256 + byte] = next;
 
-    string seeking_file;
-    // prompt a name of a file seeking for
-    cout << "\nPlease type a name of a file or directory: ";
-    cin >> seeking_file;
+        return next;
+    }
 
-    // break a new line
-    cout << "\n"
-         << endl;
+    // build the Aho-Corasick automaton over the literals
+    void compile_literals()
+    {
+        memset(byte_class, 0, sizeof(byte_class));
+        class_count = 1;
 
-    string command = "ls ~/" + directory;
+        for (const string &pattern : patterns)
+        {
+            if (is_glob(pattern))
+            {
+                continue;
+            }
+            for (unsigned char byte : pattern)
+            {
+                if (byte_class[byte] == 0)
+                {
+                    byte_class[byte] = class_count++;
+                }
+            }
+        }
 
-    pipeline(command, CustomGrep(seeking_file));
+        // the trie, with -1 for a missing edge
+        transitions.assign(class_count, -1);
+        outputs.assign(1, vector<uint32_t>());
 
-    return 0;
-}
\ No newline at end of file
+        for (uint32_t id = 0; id < patterns.size(); id++)
+        {
+            const string &pattern = patterns[id];
+            if (is_glob(pattern))
+            {
+                continue;
+            }
+            if (pattern.empty())
+            {
+                match_all.push_back(id);
+                continue;
+            }
+
+            has_literals = true;
+            int state = 0;
+            for (unsigned char byte : pattern)
+            {
+                int &next = transitions[state * class_count + byte_class[byte]];
+                if (next == -1)
+                {
+                    next = outputs.size();
+                    outputs.push_back(vector<uint32_t>());
+                    transitions.resize(transitions.size() + class_count, -1);
+                }
+                state = transitions[state * class_count + byte_class[byte]];
+            }
+            outputs[state].push_back(id);
+        }
+
+        // breadth-first, turn every missing edge into the edge of the failure state, so matching never backtracks
+        vector<int> failure(outputs.size(), 0);
+        output_link.assign(outputs.size(), -1);
+        deque<int> queue;
+
+        for (int c = 0; c < class_count; c++)
+        {
+            int &next = transitions[c];
+            if (next == -1)
+            {
+                next = 0;
+            }
+            else
+            {
+                queue.push_back(next);
+            }
+        }
+
+        while (!queue.empty())
+        {
+            int state = queue.front();
+            queue.pop_front();
+
+            for (int c = 0; c < class_count; c++)
+            {
+                int next = transitions[state * class_count + c];
+                int fallback = transitions[failure[state] * class_count + c];
+
+                if (next == -1)
+                {
+                    transitions[state * class_count + c] = fallback;
+                    continue;
+                }
+
+                failure[next] = fallback;
+                output_link[next] = outputs[fallback].empty() ? output_link[fallback] : fallback;
+                queue.push_back(next);
+            }
+        }
+    }
+
+public:
+    // whether a pattern is a glob, rather than a literal
+    static bool is_glob(const string &pattern)
+    {
+        return pattern.find_first_of("*?[") != string::npos;
+    }
+
+    // add a pattern; return its id
+    uint32_t add(const string &pattern)
+    {
+        patterns.push_back(pattern);
+        return patterns.size() - 1;
+    }
+
+    size_t size() const
+    {
+        return patterns.size();
+    }
+
+    const string &pattern(uint32_t id) const
+    {
+        return patterns[id];
+    }
+
+    // compile the patterns added so far
+    void compile()
+    {
+        match_all.clear();
+        has_literals = false;
+        compile_literals();
+
+        items.clear();
+        position_glob.clear();
+        accepting_position.clear();
+        glob_pattern.clear();
+        glob_start.clear();
+
+        for (uint32_t id = 0; id < patterns.size(); id++)
+        {
+            if (is_glob(patterns[id]))
+            {
+                add_glob(patterns[id], id);
+            }
+        }
+
+        state_index.clear();
+        state_positions.clear();
+        state_accepts.clear();
+        state_transitions.clear();
+        start_state = glob_pattern.empty() ? -1 : intern_state(start_positions());
+    }
+
+    /*
+        match every file of a batch of records against every pattern
+        "found(file, length, id)" is called once for each pattern a file matches, pointing into the batch
+    */
+    template <typename Found>
+    void match(const char *records, size_t length, Found found)
+    {
+        const char *end = records + length;
+        const char *position = records;
+        Record record;
+
+        // the hits of the file being matched: local, so "found" may call match again on this matcher
+        vector<uint32_t> hits;
+
+        while ((position = read_record(position, end, record)) != nullptr)
+        {
+            int literal_state = 0;
+            int glob_state = start_state;
+            hits.clear();
+
+            for (size_t i = 0; i < record.length; i++)
+            {
+                unsigned char byte = record.name[i];
+
+                if (has_literals)
+                {
+                    literal_state = transitions[literal_state * class_count + byte_class[byte]];
+
+                    for (int state = outputs[literal_state].empty() ? output_link[literal_state] : literal_state;
+                         state != -1; state = output_link[state])
+                    {
+                        hits.insert(hits.end(), outputs[state].begin(), outputs[state].end());
+                    }
+                }
+
+                // a glob is matched against the name after the last slash (/)
+                if (glob_state != -1)
+                {
+                    glob_state = byte == '/' ? start_state : step_glob(glob_state, byte);
+                }
+            }
+
+            // the end of a file: report its hits
+            if (glob_state != -1)
+            {
+                hits.insert(hits.end(), state_accepts[glob_state].begin(), state_accepts[glob_state].end());
+            }
+            hits.insert(hits.end(), match_all.begin(), match_all.end());
+
+            // a literal found twice in a file is a single hit
+            if (hits.size() > 1)
+            {
+                sort(hits.begin(), hits.end());
+                hits.erase(unique(hits.begin(), hits.end()), hits.end());
+            }
+
+            for (uint32_t id : hits)
+            {
+                found(record.name, record.length, id);
+            }
+        }
+    }
+};
+
+// a simple program to function similar to "grep" command
+class CustomGrep
+{
+private:
+    // every file or pattern seeking for, compiled for a search in a single pass
+    static PatternMatcher matcher;
+
+    // the number of files identified so far
+    static size_t match_count;
+
+public:
+    CustomGrep() = default;
+
+    CustomGrep(string file)
+    {
+        matcher = PatternMatcher();
+        matcher.add(file);
+        matcher.compile();
+    }
+
+    // seek for several files at once; a file may be a literal name or a shell-style glob (see PatternMatcher)
+    CustomGrep(const vector<string> &files)
+    {
+        matcher = PatternMatcher();
+        for (const string &file : files)
+        {
+            matcher.add(file);
+        }
+        matcher.compile();
+    }
+
+    // the number of files or patterns seeking for, and each of them by its id
+    static size_t pattern_count()
+    {
+        return matcher.size();
+    }
+
+    static const string &pattern(uint32_t id)
+    {
+        return matcher.pattern(id);
+    }
+
+    /*
+        identify the file(s) matching any of the patterns from a batch of records of the listing of "~/[path]"
+        "found(file, length, id)" is called for every hit, with the id of the pattern matched
+
+        a single literal name is searched with the substring kernel; anything else with the compiled patterns
+    */
+    template <typename Found>
+    static void match_batch(const char *files, size_t length, Found found)
+    {
+        match_batch(matcher, files, length, found);
+    }
+
+    // the same, with the patterns of "patterns" rather than the ones seeking for (e.g. for a query of the server)
+    template <typename Found>
+    static void match_batch(PatternMatcher &patterns, const char *files, size_t length, Found found)
+    {
+        if (patterns.size() == 1 && !PatternMatcher::is_glob(patterns.pattern(0)))
+        {
+            match_literal(patterns.pattern(0), files, length, [&found](const char *file, size_t file_length)
+                          { found(file, file_length, 0); });
+            return;
+        }
+
+        patterns.match(files, length, found);
+    }
+
+    /*
+        identify the file(s), whose name contains "literal", from a batch of records of the listing
+
+        rather than going through the batch record by record, the whole batch is scanned for the seeking data with find_substring,
+        and only at an occurrence is the record it falls in looked up, by stepping over the records up to it
+        an occurrence outside of a name (in the fields of a record, or across two records) is skipped
+        "found(file, length)" is called for every identified file, pointing into the batch, so nothing is allocated
+    */
+    template <typename Found>
+    static void match_literal(const string &literal, const char *files, size_t length, Found found)
+    {
+        const char *end = files + length;
+        const char *needle = literal.data();
+        size_t needle_length = literal.size();
+
+        // the record being looked at, and where the next one starts
+        Record record;
+        const char *record_end = read_record(files, end, record);
+        const char *position = files;
+
+        while (record_end && position < end)
+        {
+            // IF the seeking data is a substring of or equal to a file, THEN hand the file over
+            const char *occurrence = find_substring(position, end, needle, needle_length);
+            if (!occurrence)
+            {
+                return;
+            }
+
+            while (record_end && record_end <= occurrence)
+            {
+                record_end = read_record(record_end, end, record);
+            }
+            if (!record_end)
+            {
+                return;
+            }
+
+            if (occurrence >= record.name && occurrence + needle_length <= record_end)
+            {
+                found(record.name, record.length);
+
+                // continue after the file, so it is not handed over twice
+                position = record_end;
+                record_end = read_record(record_end, end, record);
+            }
+            else
+            {
+                position = occurrence + 1;
+            }
+        }
+    }
+
+    // display an identified file, with the pattern it matched when seeking for several
+    static void display(const char *file, size_t length, uint32_t id)
+    {
+        if (match_count == 0)
+        {
+            cout << "\nRESULT:\n"
+                 << endl;
+        }
+
+        cout.write(file, length);
+        if (matcher.size() > 1)
+        {
+            cout << "\t[" << matcher.pattern(id) << "]";
+        }
+        cout << '\n';
+        match_count++;
+    }
+
+    // identify the file(s) from a batch, and display them as soon as they are found
+    static void grep_batch(const char *files, size_t length)
+    {
+        match_batch(files, length, display);
+    }
+
+    // conclude a search, once every batch has been passed to grep_batch
+    static void report()
+    {
+        // IF nothing is found, THEN terminate the program
+        if (match_count == 0)
+        {
+            cout << "\nFile does not found\n"
+                 << endl;
+            return;
+        }
+
+        // break a new line
+        cout << "\n"
+             << endl;
+
+        match_count = 0;
+    }
+};
+
+/*
+    read every entry of an open directory and hand it to "callback(name, length, type, inode)"
+
+    on Linux, the entries are read in bulk with the getdents64 system call,
+    which avoids a library call (and a copy into a DIR stream) per entry
+    on other systems, it falls back to readdir on a duplicate of the descriptor
+
+    "." and ".." are skipped; return false if the directory cannot be read
+*/
+#ifdef __linux__
+struct linux_dirent64
+{
+    ino64_t d_ino;
+    off64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+#endif
+
+const int DIRENT_BUFFER_SIZE = 32768;
+
+template <typename Callback>
+bool read_directory_entries(int directory_fd, Callback callback)
+{
+#ifdef __linux__
+    alignas(8) char buffer[DIRENT_BUFFER_SIZE];
+
+    while (true)
+    {
+        long read_byte = syscall(SYS_getdents64, directory_fd, buffer, sizeof(buffer));
+
+        if (read_byte == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (read_byte == -1)
+        {
+            return false;
+        }
+        // end of the directory
+        if (read_byte == 0)
+        {
+            return true;
+        }
+
+        for (long offset = 0; offset < read_byte;)
+        {
+            linux_dirent64 *entry = reinterpret_cast<linux_dirent64 *>(buffer + offset);
+            offset += entry->d_reclen;
+
+            const char *name = entry->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+            {
+                continue;
+            }
+
+            callback(name, strlen(name), entry->d_type, entry->d_ino);
+        }
+    }
+#else
+    // closedir also closes the descriptor, so hand it a duplicate
+    int duplicate_fd = dup(directory_fd);
+    DIR *directory = duplicate_fd == -1 ? nullptr : fdopendir(duplicate_fd);
+
+    if (!directory)
+    {
+        if (duplicate_fd != -1)
+        {
+            close(duplicate_fd);
+        }
+        return false;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(directory)) != nullptr)
+    {
+        const char *name = entry->d_name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+        {
+            continue;
+        }
+
+        callback(name, strlen(name), entry->d_type, entry->d_ino);
+    }
+
+    closedir(directory);
+    return true;
+#endif
+}
+
+/*
+    DirectoryWalker class enumerates a directory tree within the process, instead of running "ls" through a shell
+
+    - every directory is opened with openat relative to the root, and read with read_directory_entries
+    - sub-directories are queued, and the queue is drained in parallel by a pool of threads
+    - each thread collects its entries into a local batch of records, and hands the batch to a sink once it fills up,
+      so the listing streams out while the walk is still in progress
+    - every directory gets an id (the root is 0), which the records can carry (see the record format)
+
+    as "ls" does, hidden entries (starting with ".") are not listed, and symbolic links are not followed
+*/
+class DirectoryWalker
+{
+public:
+    // a sink receives a batch of records, each named by the path relative to the root
+    // calls to the sink are serialized by the walker, so it does not need its own lock
+    // the sink returns false to stop the walk (e.g. when the consumer is gone)
+    typedef function<bool(const char *, size_t)> Sink;
+
+    // a directory callback receives the relative path ("" for the root) and the status of every directory listed
+    // like the sink, calls to it are serialized
+    typedef function<void(const string &, const struct stat &)> DirectoryCallback;
+
+private:
+    int thread_count;
+    size_t batch_size;
+    bool group_by_directory;
+
+    // the optional fields written into every record
+    uint8_t record_fields = 0;
+
+    int root_fd = -1;
+    Sink sink;
+    DirectoryCallback directory_callback;
+
+    // shared resources among all worker threads
+    mutex queue_mutex;
+    condition_variable queue_condition;
+    deque<pair<string, uint32_t>> pending_directories;
+    atomic<uint32_t> next_directory_id;
+    int busy_workers = 0;
+    bool cancelled = false;
+
+    mutex sink_mutex;
+
+    // hand a batch to the sink, then reuse its storage
+    void flush(string &batch)
+    {
+        if (batch.empty())
+        {
+            return;
+        }
+
+        lock_guard<mutex> lock(sink_mutex);
+
+        if (!cancelled && !sink(batch.data(), batch.size()))
+        {
+            lock_guard<mutex> queue_lock(queue_mutex);
+            cancelled = true;
+            queue_condition.notify_all();
+        }
+
+        batch.clear();
+    }
+
+    // list a single directory, queueing its sub-directories for any worker thread
+    void read_directory(const string &relative_path, uint32_t directory_id, string &batch)
+    {
+        int directory_fd = relative_path.empty()
+                               ? dup(root_fd)
+                               : openat(root_fd, relative_path.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+
+        if (directory_fd == -1)
+        {
+            fprintf(stderr, "Failed to open the directory \"%s\": %s\n", relative_path.c_str(), strerror(errno));
+            return;
+        }
+
+        struct stat status;
+        if (directory_callback && fstat(directory_fd, &status) == 0)
+        {
+            lock_guard<mutex> lock(sink_mutex);
+            directory_callback(relative_path, status);
+        }
+
+        string prefix = relative_path.empty() ? "" : relative_path + "/";
+        vector<pair<string, uint32_t>> sub_directories;
+
+        Record record;
+        record.flags = record_fields;
+        record.parent = directory_id;
+
+        bool success = read_directory_entries(directory_fd, [&](const char *name, size_t length, unsigned char type, uint64_t inode)
+                                              {
+            // hidden entries are not listed, as "ls" does
+            if (name[0] == '.')
+            {
+                return;
+            }
+            if (prefix.size() + length > MAX_RECORD_NAME)
+            {
+                report_long_path(prefix, length);
+                return;
+            }
+
+            // some file systems do not report the type of an entry, so look it up (the size needs a look-up as well)
+            struct stat status;
+            bool stated = false;
+            if (type == DT_UNKNOWN || (record_fields & RECORD_SIZE))
+            {
+                stated = fstatat(directory_fd, name, &status, AT_SYMLINK_NOFOLLOW) == 0;
+                if (stated && type == DT_UNKNOWN && S_ISDIR(status.st_mode))
+                {
+                    type = DT_DIR;
+                }
+            }
+
+            record.name = name;
+            record.length = length;
+            record.type = type;
+            record.inode = inode;
+            record.size = stated ? status.st_size : 0;
+            record.flags = record_fields & ~(type == DT_DIR ? 0 : RECORD_DIRECTORY_ID);
+
+            if (type == DT_DIR)
+            {
+                record.directory_id = next_directory_id++;
+                sub_directories.push_back(make_pair(prefix + string(name, length), record.directory_id));
+            }
+
+            append_record(batch, record, prefix.data(), prefix.size());
+
+            if (batch.size() >= batch_size)
+            {
+                flush(batch);
+            } });
+
+        if (!success)
+        {
+            fprintf(stderr, "Failed to read the directory \"%s\": %s\n", relative_path.c_str(), strerror(errno));
+        }
+
+        close(directory_fd);
+
+        // keep every batch within a single directory, if asked to
+        if (group_by_directory)
+        {
+            flush(batch);
+        }
+
+        if (!sub_directories.empty())
+        {
+            lock_guard<mutex> lock(queue_mutex);
+            for (pair<string, uint32_t> &sub_directory : sub_directories)
+            {
+                pending_directories.push_back(move(sub_directory));
+            }
+            queue_condition.notify_all();
+        }
+    }
+
+    // take directories from the queue until the whole tree is listed
+    void worker()
+    {
+        string batch;
+        batch.reserve(batch_size + PATH_MAX);
+
+        while (true)
+        {
+            pair<string, uint32_t> directory;
+
+            {
+                unique_lock<mutex> lock(queue_mutex);
+
+                // the walk is over once the queue is empty and no thread can add to it anymore
+                queue_condition.wait(lock, [this]
+                                     { return !pending_directories.empty() || busy_workers == 0 || cancelled; });
+
+                if (pending_directories.empty() || cancelled)
+                {
+                    break;
+                }
+
+                directory = move(pending_directories.front());
+                pending_directories.pop_front();
+                busy_workers++;
+            }
+
+            read_directory(directory.first, directory.second, batch);
+
+            {
+                lock_guard<mutex> lock(queue_mutex);
+                busy_workers--;
+                if (busy_workers == 0 && pending_directories.empty())
+                {
+                    queue_condition.notify_all();
+                }
+            }
+        }
+
+        flush(batch);
+    }
+
+public:
+    // with "group_by_directory", a batch never holds entries of two directories
+    DirectoryWalker(int thread_count, size_t batch_size, bool group_by_directory = false)
+    {
+        this->thread_count = thread_count > 0 ? thread_count : 1;
+        this->batch_size = batch_size;
+        this->group_by_directory = group_by_directory;
+    }
+
+    // write the optional fields "fields" (RECORD_INODE, RECORD_SIZE, RECORD_PARENT, RECORD_DIRECTORY_ID) into every record
+    void set_record_fields(uint8_t fields)
+    {
+        record_fields = fields;
+    }
+
+    // have every directory listed by the next walks reported to "callback"
+    void on_directory(DirectoryCallback callback)
+    {
+        directory_callback = callback;
+    }
+
+    // walk the tree under "root", streaming its entries into "sink"
+    // return false if "root" cannot be opened, or the sink stopped the walk
+    bool walk(const string &root, Sink sink)
+    {
+        root_fd = open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+        if (root_fd == -1)
+        {
+            fprintf(stderr, "Failed to open the directory \"%s\": %s\n", root.c_str(), strerror(errno));
+            return false;
+        }
+
+        this->sink = sink;
+        pending_directories.clear();
+        pending_directories.push_back(make_pair(string(), 0u));
+        next_directory_id = 1;
+        busy_workers = 0;
+        cancelled = false;
+
+        vector<thread> workers;
+        for (int i = 0; i < thread_count; i++)
+        {
+            workers.push_back(thread(&DirectoryWalker::worker, this));
+        }
+
+        for (thread &worker : workers)
+        {
+            worker.join();
+        }
+
+        close(root_fd);
+        root_fd = -1;
+
+        return !cancelled;
+    }
+};
+
+// return the number of threads to walk a directory tree with
+int walker_thread_count()
+{
+    unsigned int cores = thread::hardware_concurrency();
+    return cores > 0 ? cores : 4;
+}
+
+/* IPC implementation using a pipe (|) */
+
+// the size of a batch of the listing, and so the largest payload of a frame sent through the pipe
+const int BUFFER_SIZE = 65536;
+const int READ_END = 0;
+const int WRITE_END = 1;
+
+/*
+    the largest frame payload a reader accepts unless told otherwise
+    every frame of the program holds at most a batch and one record (or one hit) past it, well under this;
+    the length in a frame header comes from the other process (or a client of the server), so it is checked, not trusted
+*/
+const size_t MAX_FRAME_SIZE = 4 * BUFFER_SIZE;
+
+// collect a start time for the transmission, set by the pipeline once the prompts are answered
+// (a steady clock: the wall clock may jump while the data is in flight)
+chrono::steady_clock::time_point time_start;
+
+// display the error in "errno" after a failed read or write
+void report_io_error()
+{
+    // EPIPE: "broken pipe" error
+    if (errno == EPIPE)
+    {
+        cerr << "\n\"BROKEN PIPE\" ERROR: " << strerror(errno) << endl;
+    }
+    // EAGAIN: "resource temporarily unavailable" error
+    // it occurs when an operation is attempted on non-blocking object
+    else if (errno == EAGAIN)
+    {
+        cerr << "\n\"RESOURCE TEMPORARILY UNAVAILABLE\" ERROR: " << strerror(errno) << endl;
+    }
+    // EINTR: "interrupted system call" error
+    else if (errno == EINTR)
+    {
+        cerr << "\n\"INTERRUPTED SYSTEM CALL\" ERROR: " << strerror(errno) << endl;
+    }
+    // EBADF: "bad file descriptor" error
+    else if (errno == EBADF)
+    {
+        cerr << "\n\"BAD FILE DESCRIPTOR\" ERROR: " << strerror(errno) << endl;
+    }
+    // ENOMEM: "cannot allocate memory" error
+    else if (errno == ENOMEM)
+    {
+        cerr << "\n\"CANNOT ALLOCATE MEMORY\" ERROR: " << strerror(errno) << endl;
+    }
+    else
+    {
+        cerr << "\nERROR: " << strerror(errno) << endl;
+    }
+}
+
+/*
+    a single write on a pipe may transfer fewer bytes than asked (a partial transfer),
+    or be interrupted by a signal before transferring anything (EINTR)
+    this helper loops until the whole buffer is transferred
+*/
+
+// write every byte of "data"; return false on error, with "errno" set
+bool write_all(int fd, const void *data, size_t length)
+{
+    const char *position = static_cast<const char *>(data);
+
+    while (length > 0)
+    {
+        ssize_t write_byte = write(fd, position, length);
+
+        if (write_byte == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+
+        position += write_byte;
+        length -= write_byte;
+    }
+
+    return true;
+}
+
+/*
+    Framed protocol over the pipe
+
+    the listing is streamed as a sequence of frames, each a 4-byte length followed by that many bytes of payload
+    a frame of length 0 marks the end of the stream, so the consumer can tell a complete listing from a producer that died
+
+    both ends are on the same machine, so the length is kept in the native byte order
+*/
+typedef uint32_t FrameHeader;
+
+// write a frame holding "data"; return false on error, with "errno" set
+bool write_frame(int fd, const char *data, size_t length)
+{
+    FrameHeader header = length;
+
+    if (length == 0)
+    {
+        return write_all(fd, &header, sizeof(header));
+    }
+
+    // send the header and the payload with a single system call where possible
+    struct iovec parts[2] = {{&header, sizeof(header)}, {const_cast<char *>(data), length}};
+    ssize_t write_byte;
+
+    do
+    {
+        write_byte = writev(fd, parts, 2);
+    } while (write_byte == -1 && errno == EINTR);
+
+    if (write_byte == -1)
+    {
+        return false;
+    }
+
+    // finish a partial write
+    size_t written = write_byte;
+    if (written < sizeof(header))
+    {
+        return write_all(fd, reinterpret_cast<char *>(&header) + written, sizeof(header) - written) &&
+               write_all(fd, data, length);
+    }
+
+    written -= sizeof(header);
+    return write_all(fd, data + written, length - written);
+}
+
+// write the frame that marks the end of the stream
+bool write_end_frame(int fd)
+{
+    return write_frame(fd, nullptr, 0);
+}
+
+// append a frame to "out", to be written later (a zero-length frame marks the end of the stream)
+void append_frame(string &out, const char *data, size_t length)
+{
+    FrameHeader header = length;
+    out.append(reinterpret_cast<const char *>(&header), sizeof(header));
+    if (length > 0)
+    {
+        out.append(data, length);
+    }
+}
+
+/*
+    FrameReader class reads frames from a pipe
+
+    it reads as much as the pipe holds into a buffer, and hands out the frames where they lie in the buffer,
+    so most frames cost no system call, and the memory in use is bounded by the largest frame
+*/
+class FrameReader
+{
+private:
+    int fd;
+    vector<char> buffer;
+
+    // the largest payload accepted: a larger header means a corrupt stream (or a hostile peer), not a frame to allocate
+    size_t max_frame;
+
+    // the bytes from "begin" up to "end" are read but not yet handed out
+    size_t begin = 0;
+    size_t end = 0;
+
+    // read at least "needed" bytes past "begin"; return false at the end of the stream or on error
+    bool fill(size_t needed)
+    {
+        if (end - begin >= needed)
+        {
+            return true;
+        }
+
+        // move the unread bytes to the front, then grow the buffer if a frame does not fit
+        if (begin > 0)
+        {
+            memmove(buffer.data(), buffer.data() + begin, end - begin);
+            end -= begin;
+            begin = 0;
+        }
+        if (buffer.size() < needed)
+        {
+            buffer.resize(needed);
+        }
+
+        while (end < needed)
+        {
+            ssize_t read_byte = read(fd, buffer.data() + end, buffer.size() - end);
+
+            if (read_byte == -1)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return false;
+            }
+            if (read_byte == 0)
+            {
+                // the stream ended without an end frame
+                errno = EPIPE;
+                return false;
+            }
+
+            end += read_byte;
+        }
+
+        return true;
+    }
+
+public:
+    FrameReader(int fd, size_t capacity, size_t max_frame = MAX_FRAME_SIZE)
+    {
+        this->fd = fd;
+        this->max_frame = max_frame;
+        buffer.resize(capacity);
+    }
+
+    /*
+        read once, as much as the buffer takes, from a descriptor that may be non-blocking
+        return the bytes read, 0 at the end of the stream, and -1 on error, with "errno" set (EAGAIN: nothing to read yet)
+    */
+    ssize_t read_some()
+    {
+        if (begin > 0)
+        {
+            memmove(buffer.data(), buffer.data() + begin, end - begin);
+            end -= begin;
+            begin = 0;
+        }
+
+        // make room for the whole frame being read, or more room once the buffer is full
+        FrameHeader header;
+        if (end >= sizeof(header))
+        {
+            memcpy(&header, buffer.data(), sizeof(header));
+            if (header > max_frame)
+            {
+                errno = EMSGSIZE;
+                return -1;
+            }
+            if (buffer.size() < sizeof(header) + header)
+            {
+                buffer.resize(sizeof(header) + header);
+            }
+        }
+        if (end == buffer.size())
+        {
+            buffer.resize(2 * buffer.size());
+        }
+
+        while (true)
+        {
+            ssize_t read_byte = read(fd, buffer.data() + end, buffer.size() - end);
+
+            if (read_byte == -1 && errno == EINTR)
+            {
+                continue;
+            }
+            if (read_byte > 0)
+            {
+                end += read_byte;
+
+                // refuse an oversized frame as soon as its header is in, not once it was sent in full
+                if (end >= sizeof(header))
+                {
+                    memcpy(&header, buffer.data(), sizeof(header));
+                    if (header > max_frame)
+                    {
+                        errno = EMSGSIZE;
+                        return -1;
+                    }
+                }
+            }
+
+            return read_byte;
+        }
+    }
+
+    // whether a whole frame is already in the buffer, so the next call does not read
+    bool has_buffered_frame() const
+    {
+        FrameHeader header;
+        if (end - begin < sizeof(header))
+        {
+            return false;
+        }
+
+        memcpy(&header, buffer.data() + begin, sizeof(header));
+        return end - begin - sizeof(header) >= header;
+    }
+
+    /*
+        read the next frame, pointing "data" to its payload in the buffer (valid until the next call)
+
+        return 1 for a frame, 0 at the end of the stream, and -1 on error, with "errno" set
+    */
+    int next(const char *&data, size_t &length)
+    {
+        FrameHeader header;
+
+        if (!fill(sizeof(header)))
+        {
+            return -1;
+        }
+
+        memcpy(&header, buffer.data() + begin, sizeof(header));
+        begin += sizeof(header);
+
+        if (header == 0)
+        {
+            return 0;
+        }
+        if (header > max_frame)
+        {
+            errno = EMSGSIZE;
+            return -1;
+        }
+
+        if (!fill(header))
+        {
+            return -1;
+        }
+
+        data = buffer.data() + begin;
+        length = header;
+        begin += header;
+
+        return 1;
+    }
+};
+
+/*
+    Transport class is a one-way channel of frames, from the producer (parent) to the consumer (child)
+
+    open() is called before fork(), so both processes inherit the channel
+    after fork(), each process keeps only its own side of it
+*/
+class Transport
+{
+public:
+    virtual ~Transport() {}
+
+    // a short name to display
+    virtual const char *name() const = 0;
+
+    // create the channel; return false on error
+    virtual bool open() = 0;
+
+    // release the side of the channel that this process does not use
+    virtual void producer_side() = 0;
+    virtual void consumer_side() = 0;
+
+    // producer: send a frame, or mark the end of the stream; return false on error, with "errno" set
+    virtual bool send(const char *data, size_t length) = 0;
+    virtual bool finish() = 0;
+
+    /*
+        consumer: point "data" to the payload of the next frame, valid until the next call
+        return 1 for a frame, 0 at the end of the stream, and -1 on error, with "errno" set
+    */
+    virtual int receive(const char *&data, size_t &length) = 0;
+
+    /*
+        producer: reserve room to build a frame of "length" bytes in place, then send it with commit
+        a transport with memory of its own (the ring, the splice arena) hands out that memory;
+        otherwise, the frame is built in a staging buffer and sent from there
+    */
+    virtual char *reserve(size_t length)
+    {
+        staging.resize(length);
+        return staging.data();
+    }
+
+    virtual bool commit(size_t length)
+    {
+        return send(staging.data(), length);
+    }
+
+    // the descriptor the frames are written to, for a producer that writes them by itself; -1 if they are not
+    virtual int stream_fd() const
+    {
+        return -1;
+    }
+
+protected:
+    vector<char> staging;
+};
+
+// PipeTransport class sends the frames through an ordinary pipe
+class PipeTransport : public Transport
+{
+protected:
+    // file descriptors (have a parent-child relationship)
+    // - write by the parent to its write end of the pipe: fd[1]
+    // - read by the child from its read end of the pipe: fd[0]
+    int fd[2] = {-1, -1};
+    int capacity;
+
+    // the largest payload of a frame the consumer accepts
+    size_t largest_payload;
+
+    FrameReader *reader = nullptr;
+
+public:
+    PipeTransport(int capacity, size_t largest_payload = MAX_FRAME_SIZE)
+    {
+        this->capacity = capacity;
+        this->largest_payload = largest_payload;
+    }
+
+    ~PipeTransport()
+    {
+        delete reader;
+
+        for (int end : fd)
+        {
+            if (end != -1)
+            {
+                close(end);
+            }
+        }
+    }
+
+    const char *name() const
+    {
+        return "pipe";
+    }
+
+    bool open()
+    {
+        // create the pipe
+        if (pipe(fd) == -1)
+        {
+            fprintf(stderr, "\nPipe Creation Failed\n");
+            return false;
+        }
+
+#ifdef F_SETPIPE_SZ
+        // a larger pipe lets the parent run further ahead of the child, with fewer context switches
+        // the request may be refused (e.g. above /proc/sys/fs/pipe-max-size), then the default capacity is kept
+        if (capacity > 0 && fcntl(fd[WRITE_END], F_SETPIPE_SZ, capacity) == -1)
+        {
+            fprintf(stderr, "Failed to resize the pipe to %d bytes: %s\n", capacity, strerror(errno));
+        }
+#endif
+
+        return true;
+    }
+
+    void producer_side()
+    {
+        // close the un-used end of the pipe
+        close(fd[READ_END]);
+        fd[READ_END] = -1;
+    }
+
+    void consumer_side()
+    {
+        // close the un-used end of the pipe
+        close(fd[WRITE_END]);
+        fd[WRITE_END] = -1;
+
+        // read as much as the pipe can hold at once
+        reader = new FrameReader(fd[READ_END], max(2 * BUFFER_SIZE, capacity), largest_payload);
+    }
+
+    bool send(const char *data, size_t length)
+    {
+        return write_frame(fd[WRITE_END], data, length);
+    }
+
+    bool finish()
+    {
+        return write_end_frame(fd[WRITE_END]);
+    }
+
+    int stream_fd() const
+    {
+        return fd[WRITE_END];
+    }
+
+    int receive(const char *&data, size_t &length)
+    {
+        return reader->next(data, length);
+    }
+};
+
+/*
+    SocketpairTransport class sends the frames through a connected pair of Unix domain sockets
+
+    the frames are the same as through a pipe; only the channel differs,
+    so it shows what a socket (e.g. to a process that was not forked) costs compared with a pipe
+*/
+class SocketpairTransport : public PipeTransport
+{
+public:
+    SocketpairTransport(int capacity, size_t largest_payload = MAX_FRAME_SIZE) : PipeTransport(capacity, largest_payload) {}
+
+    const char *name() const
+    {
+        return "socketpair";
+    }
+
+    bool open()
+    {
+        // a stream socket keeps the frames in order and unbroken, like a pipe
+        // fd[0] is used as the read end and fd[1] as the write end, as for the pipe
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fd) == -1)
+        {
+            fprintf(stderr, "\nSocket Pair Creation Failed: %s\n", strerror(errno));
+            return false;
+        }
+
+        // the buffers of a socket play the part of the capacity of the pipe
+        if (capacity > 0)
+        {
+            setsockopt(fd[WRITE_END], SOL_SOCKET, SO_SNDBUF, &capacity, sizeof(capacity));
+            setsockopt(fd[READ_END], SOL_SOCKET, SO_RCVBUF, &capacity, sizeof(capacity));
+        }
+
+        return true;
+    }
+};
+
+/*
+    SpliceTransport class sends the frames through an ordinary pipe, without copying them into the pipe
+
+    write() copies every byte from the producer into the pages of the pipe
+    vmsplice() instead hands the pages of the producer to the pipe, so the consumer reads straight from them
+
+    the producer builds each frame (header and payload) in place, at the start of a page of an arena,
+    and must not touch those pages again while the pipe may still refer to them
+    a pipe refers to at most "capacity / page size" pages, and frames take the pages of the arena in turn,
+    so once more pages than that were handed over after a page, the page is safe to reuse
+    the arena is sized for that: twice the pages of the pipe, plus the pages of the largest frame
+
+    the consumer side is the same as PipeTransport: it drains the pipe with large reads into a reusable buffer
+*/
+class SpliceTransport : public PipeTransport
+{
+private:
+    size_t page_size = 0;
+    size_t arena_pages = 0;
+    char *arena = nullptr;
+
+    // the page where the next frame starts, and the one reserved last
+    size_t next_page = 0;
+    char *reserved = nullptr;
+
+    // the largest payload of a frame (in PipeTransport): by default, a batch from the walker,
+    // which may exceed BUFFER_SIZE by one record
+    size_t largest_frame() const
+    {
+        return sizeof(FrameHeader) + largest_payload;
+    }
+
+public:
+    SpliceTransport(int capacity, size_t largest_payload = BUFFER_SIZE + MAX_RECORD_SIZE) : PipeTransport(capacity, largest_payload) {}
+
+    ~SpliceTransport()
+    {
+        if (arena)
+        {
+            munmap(arena, arena_pages * page_size);
+        }
+    }
+
+    const char *name() const
+    {
+        return "splice";
+    }
+
+    // the frames go through vmsplice, not write
+    int stream_fd() const
+    {
+        return -1;
+    }
+
+    bool open()
+    {
+        if (!PipeTransport::open())
+        {
+            return false;
+        }
+
+        page_size = sysconf(_SC_PAGESIZE);
+
+        // size the arena after the capacity the pipe actually got
+        long pipe_capacity = 65536;
+#ifdef F_GETPIPE_SZ
+        long actual = fcntl(fd[WRITE_END], F_GETPIPE_SZ);
+        if (actual > 0)
+        {
+            pipe_capacity = actual;
+        }
+#endif
+        size_t frame_pages = (largest_frame() + page_size - 1) / page_size;
+        arena_pages = 2 * (pipe_capacity / page_size) + frame_pages;
+
+        void *mapping = mmap(nullptr, arena_pages * page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapping == MAP_FAILED)
+        {
+            fprintf(stderr, "\nArena Creation Failed: %s\n", strerror(errno));
+            return false;
+        }
+        arena = static_cast<char *>(mapping);
+
+        return true;
+    }
+
+    char *reserve(size_t length)
+    {
+        size_t size = sizeof(FrameHeader) + length;
+        if (size > largest_frame())
+        {
+            errno = EMSGSIZE;
+            return nullptr;
+        }
+
+        // a frame does not wrap around, so start over from the first page if it does not fit
+        size_t pages = (size + page_size - 1) / page_size;
+        if (next_page + pages > arena_pages)
+        {
+            next_page = 0;
+        }
+
+        reserved = arena + next_page * page_size;
+        next_page += pages;
+
+        return reserved + sizeof(FrameHeader);
+    }
+
+    bool commit(size_t length)
+    {
+        FrameHeader header = length;
+        memcpy(reserved, &header, sizeof(header));
+
+        struct iovec frame = {reserved, sizeof(header) + length};
+
+        // like write(), vmsplice() may transfer only a part of the frame
+        while (frame.iov_len > 0)
+        {
+#ifdef __linux__
+            ssize_t splice_byte = vmsplice(fd[WRITE_END], &frame, 1, 0);
+#else
+            ssize_t splice_byte = write(fd[WRITE_END], frame.iov_base, frame.iov_len);
+#endif
+
+            if (splice_byte == -1)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return false;
+            }
+
+            frame.iov_base = static_cast<char *>(frame.iov_base) + splice_byte;
+            frame.iov_len -= splice_byte;
+        }
+
+        return true;
+    }
+
+    bool send(const char *data, size_t length)
+    {
+        char *destination = reserve(length);
+        if (!destination)
+        {
+            return false;
+        }
+
+        memcpy(destination, data, length);
+
+        return commit(length);
+    }
+};
+
+#ifdef __linux__
+// block while "*word" still holds "expected", until woken or "timeout_ns" passes
+// the word is shared across processes, so FUTEX_PRIVATE_FLAG is not used
+void futex_wait(atomic<uint32_t> *word, uint32_t expected, long timeout_ns)
+{
+    struct timespec timeout = {timeout_ns / 1000000000, timeout_ns % 1000000000};
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), FUTEX_WAIT, expected, &timeout, nullptr, 0);
+}
+
+// wake every process blocked on "*word"
+void futex_wake(atomic<uint32_t> *word)
+{
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+#endif
+
+/*
+    ShmRingTransport class sends the frames through a ring buffer in shared memory
+
+    the ring is a memfd (an anonymous file in memory) mapped with MAP_SHARED before fork(),
+    so the parent and the child address the same pages, and no byte goes through the kernel
+
+    it has a single producer and a single consumer:
+    - the producer reserves space at "head", writes a record in place, then publishes it by moving "head"
+    - the consumer reads the record in place at "tail", and releases it by moving "tail" on its next receive
+    - a record is a 4-byte length followed by the payload, padded to 8 bytes;
+      a record never wraps around, the producer skips the rest of the ring with a padding marker instead
+
+    a side that finds the ring empty (or full) spins briefly, then sleeps on a futex until the other side signals it
+*/
+class ShmRingTransport : public Transport
+{
+private:
+    // the shared state at the start of the mapping
+    // the producer's and the consumer's fields are kept on separate cache lines, so they do not bounce between cores
+    struct RingHeader
+    {
+        // written by the producer: total bytes published, and a counter to wake the consumer on
+        alignas(64) atomic<uint64_t> head;
+        atomic<uint32_t> data_signal;
+        atomic<uint32_t> consumer_waiting;
+
+        // written by the consumer: total bytes released, and a counter to wake the producer on
+        alignas(64) atomic<uint64_t> tail;
+        atomic<uint32_t> space_signal;
+        atomic<uint32_t> producer_waiting;
+
+        // set by the producer once every record is published (FINISHED), or when it gives up (ABORTED)
+        alignas(64) atomic<uint32_t> finished;
+
+        // set by the consumer when it stops reading
+        atomic<uint32_t> consumer_closed;
+
+        // the processes on each side, to notice a side that died without closing
+        atomic<pid_t> producer_pid;
+        atomic<pid_t> consumer_pid;
+    };
+
+    static const uint32_t FINISHED = 1;
+    static const uint32_t ABORTED = 2;
+
+    static const uint32_t PADDING = 0xFFFFFFFF;
+    static const int SPIN_LIMIT = 256;
+    static const long WAIT_TIMEOUT_NS = 100000000;
+
+    size_t capacity;
+    size_t mapping_size = 0;
+    RingHeader *header = nullptr;
+    char *ring = nullptr;
+
+    // the size of the record handed out by the last receive, released on the next one
+    size_t held = 0;
+
+    bool producing = false;
+    bool consuming = false;
+
+    static size_t record_size(size_t length)
+    {
+        return (sizeof(uint32_t) + length + 7) & ~size_t(7);
+    }
+
+    /*
+        wait until "ready()" holds, sleeping on "signal" while the other side has nothing for this side
+        the sleep times out now and then to check "alive()", so a side that died is noticed; return false then
+    */
+    template <typename Ready, typename Alive>
+    static bool wait_for(atomic<uint32_t> &signal, atomic<uint32_t> &waiting, Ready ready, Alive alive)
+    {
+        for (int spin = 0; spin < SPIN_LIMIT; spin++)
+        {
+            if (ready())
+            {
+                return true;
+            }
+        }
+
+        while (!ready())
+        {
+            if (!alive())
+            {
+                return false;
+            }
+
+            // announce the wait before checking once more, so a signal sent in between is not missed
+            waiting.store(1);
+            uint32_t seen = signal.load();
+
+            if (!ready())
+            {
+#ifdef __linux__
+                futex_wait(&signal, seen, WAIT_TIMEOUT_NS);
+#else
+                this_thread::sleep_for(chrono::microseconds(50));
+#endif
+            }
+
+            waiting.store(0);
+        }
+
+        return true;
+    }
+
+    /*
+        whether the process on the other side is still running; either side may be the parent or the child
+        a child that exited is noticed before it is reaped (without reaping it), any other process while it exists
+    */
+    static bool process_alive(pid_t pid)
+    {
+        // the side is not taken yet
+        if (pid == 0)
+        {
+            return true;
+        }
+
+        siginfo_t info;
+        info.si_pid = 0;
+        if (waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT) == 0)
+        {
+            return info.si_pid == 0;
+        }
+
+        return kill(pid, 0) == 0 || errno == EPERM;
+    }
+
+    // the producer is alive until its process exits
+    bool producer_alive() const
+    {
+        return process_alive(header->producer_pid.load());
+    }
+
+    // the consumer is alive until it closes its side, or its process exits
+    bool consumer_alive() const
+    {
+        return !header->consumer_closed.load() && process_alive(header->consumer_pid.load());
+    }
+
+    // let the other side know that something changed
+    static void notify(atomic<uint32_t> &signal, atomic<uint32_t> &waiting)
+    {
+        signal.fetch_add(1);
+
+        if (waiting.load())
+        {
+#ifdef __linux__
+            futex_wake(&signal);
+#endif
+        }
+    }
+
+public:
+    ShmRingTransport(size_t capacity)
+    {
+        // the position of a record is "head % capacity", so keep the capacity a power of two
+        size_t size = 4096;
+        while (size < capacity)
+        {
+            size <<= 1;
+        }
+        this->capacity = size;
+    }
+
+    ~ShmRingTransport()
+    {
+        if (!header)
+        {
+            return;
+        }
+
+        // let the other side know when this side stops early
+        if (producing && header->finished.load() == 0)
+        {
+            header->finished.store(ABORTED);
+            notify(header->data_signal, header->consumer_waiting);
+        }
+        if (consuming)
+        {
+            header->consumer_closed.store(1);
+            notify(header->space_signal, header->producer_waiting);
+        }
+
+        munmap(header, mapping_size);
+    }
+
+    const char *name() const
+    {
+        return "shm";
+    }
+
+    bool open()
+    {
+        mapping_size = sizeof(RingHeader) + capacity;
+        void *mapping = MAP_FAILED;
+
+#if defined(__linux__) && defined(SYS_memfd_create)
+        int memory_fd = syscall(SYS_memfd_create, "ipc-ring", MFD_CLOEXEC);
+
+        if (memory_fd != -1)
+        {
+            if (ftruncate(memory_fd, mapping_size) == 0)
+            {
+                mapping = mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, memory_fd, 0);
+            }
+            close(memory_fd);
+        }
+#endif
+
+        // without memfd, an anonymous shared mapping is inherited by fork() just the same
+        if (mapping == MAP_FAILED)
+        {
+            mapping = mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        }
+
+        if (mapping == MAP_FAILED)
+        {
+            fprintf(stderr, "\nShared Memory Creation Failed: %s\n", strerror(errno));
+            return false;
+        }
+
+        header = new (mapping) RingHeader();
+        header->head.store(0);
+        header->data_signal.store(0);
+        header->consumer_waiting.store(0);
+        header->tail.store(0);
+        header->space_signal.store(0);
+        header->producer_waiting.store(0);
+        header->finished.store(0);
+        header->consumer_closed.store(0);
+        header->producer_pid.store(getpid());
+        header->consumer_pid.store(0);
+
+        ring = static_cast<char *>(mapping) + sizeof(RingHeader);
+
+        return true;
+    }
+
+    void producer_side()
+    {
+        // the process that opened the ring produces by default, but the child may produce instead
+        producing = true;
+        header->producer_pid.store(getpid());
+    }
+
+    void consumer_side()
+    {
+        consuming = true;
+        header->consumer_pid.store(getpid());
+    }
+
+    /*
+        reserve room for a record of "length" bytes, waiting for the consumer if the ring is full
+        return where to write the payload, or nullptr if the record can never fit
+    */
+    char *reserve(size_t length)
+    {
+        size_t size = record_size(length);
+        if (size > capacity / 2)
+        {
+            errno = EMSGSIZE;
+            return nullptr;
+        }
+
+        uint64_t head = header->head.load(memory_order_relaxed);
+        size_t offset = head & (capacity - 1);
+
+        // a record does not wrap around, so skip the rest of the ring if it does not fit there
+        size_t padding = offset + size > capacity ? capacity - offset : 0;
+
+        bool ready = wait_for(
+            header->space_signal, header->producer_waiting, [&]
+            { return head + padding + size - header->tail.load(memory_order_acquire) <= capacity; },
+            [this]
+            { return consumer_alive(); });
+
+        if (!ready)
+        {
+            errno = EPIPE;
+            return nullptr;
+        }
+
+        if (padding > 0)
+        {
+            uint32_t marker = PADDING;
+            memcpy(ring + offset, &marker, sizeof(marker));
+            header->head.store(head + padding, memory_order_release);
+            offset = 0;
+        }
+
+        return ring + offset + sizeof(uint32_t);
+    }
+
+    // publish the record reserved last, with "length" bytes of payload written
+    bool commit(size_t length)
+    {
+        uint64_t head = header->head.load(memory_order_relaxed);
+        uint32_t record_length = length;
+
+        memcpy(ring + (head & (capacity - 1)), &record_length, sizeof(record_length));
+        header->head.store(head + record_size(length), memory_order_release);
+
+        notify(header->data_signal, header->consumer_waiting);
+
+        return true;
+    }
+
+    bool send(const char *data, size_t length)
+    {
+        char *destination = reserve(length);
+        if (!destination)
+        {
+            return false;
+        }
+
+        memcpy(destination, data, length);
+
+        return commit(length);
+    }
+
+    bool finish()
+    {
+        header->finished.store(FINISHED, memory_order_release);
+        notify(header->data_signal, header->consumer_waiting);
+
+        return true;
+    }
+
+    int receive(const char *&data, size_t &length)
+    {
+        uint64_t tail = header->tail.load(memory_order_relaxed);
+
+        // release the record handed out last
+        if (held > 0)
+        {
+            tail += held;
+            held = 0;
+            header->tail.store(tail, memory_order_release);
+            notify(header->space_signal, header->producer_waiting);
+        }
+
+        while (true)
+        {
+            bool ready = wait_for(
+                header->data_signal, header->consumer_waiting, [&]
+                { return header->head.load(memory_order_acquire) != tail ||
+                         header->finished.load(memory_order_acquire); },
+                [this]
+                { return producer_alive(); });
+
+            // "finished" is set after the last record is published, so an empty ring means the end of the stream
+            if (ready && header->head.load(memory_order_acquire) == tail &&
+                header->finished.load(memory_order_acquire) == FINISHED)
+            {
+                return 0;
+            }
+            if (!ready || header->head.load(memory_order_acquire) == tail)
+            {
+                // the producer stopped before the end of the stream
+                errno = EPIPE;
+                return -1;
+            }
+
+            size_t offset = tail & (capacity - 1);
+            uint32_t record_length;
+            memcpy(&record_length, ring + offset, sizeof(record_length));
+
+            if (record_length == PADDING)
+            {
+                tail += capacity - offset;
+                header->tail.store(tail, memory_order_release);
+                notify(header->space_signal, header->producer_waiting);
+                continue;
+            }
+
+            data = ring + offset + sizeof(uint32_t);
+            length = record_length;
+            held = record_size(record_length);
+
+            return 1;
+        }
+    }
+};
+
+// a stage of --pipeline: "grep", "sort", "dedupe" or "count", with its argument, in this process or forked
+struct StageSpec
+{
+    string kind;
+    string argument;
+    bool forked = false;
+};
+
+// settings of the pipeline, given through the command line
+struct PipelineOptions
+{
+    // the transport between the processes: "pipe", "socketpair", "splice" or "shm"
+    string transport = "pipe";
+
+    // the capacity to request for the pipe, in bytes (0 keeps the system default)
+    int pipe_capacity = 1 << 20;
+
+    // the capacity of the shared-memory ring, in bytes
+    size_t ring_capacity = 4 << 20;
+
+    // compare the transports instead of running the pipeline
+    bool benchmark = false;
+
+    // the file to write the results of the benchmark to, as JSON (empty for stdout)
+    string benchmark_json;
+
+    // the number of consumer processes to fan the listing out to (0 for one per core)
+    int consumers = 1;
+
+    // how the listing is split across consumers: "round-robin" or "directory"
+    string split = "round-robin";
+
+    // display the matches in the order of the listing, rather than as the consumers find them
+    bool ordered = false;
+
+    // the names seeking for, read from a file (one per line), instead of prompting for them
+    vector<string> patterns;
+
+    // answer from an index of the directory kept in this file, instead of listing the directory
+    string index_file;
+
+    // the optional fields of the records sent to the consumers (RECORD_INODE, RECORD_SIZE, RECORD_PARENT)
+    uint8_t record_fields = 0;
+
+    // run the listing through these stages, instead of the two fixed processes
+    vector<StageSpec> stages;
+
+    // list the directory with io_uring, where available
+    bool io_uring = false;
+
+    // serve queries on this Unix domain socket, with this many worker processes (0 for one per core)
+    string serve_socket;
+    int workers = 0;
+
+    // send the query to the server on this socket, instead of listing the directory
+    string query_socket;
+};
+
+/*
+    create the transport chosen by the options; return nullptr for an unknown one
+    every frame holds a batch from the walker (which may exceed BUFFER_SIZE by one record),
+    after "frame_prefix" bytes of the caller's own (the sequence number of fan-out)
+*/
+Transport *create_transport(const PipelineOptions &options, size_t frame_prefix = 0)
+{
+    size_t largest_payload = frame_prefix + BUFFER_SIZE + MAX_RECORD_SIZE;
+
+    if (options.transport == "pipe")
+    {
+        return new PipeTransport(options.pipe_capacity);
+    }
+    if (options.transport == "socketpair")
+    {
+        return new SocketpairTransport(options.pipe_capacity);
+    }
+    if (options.transport == "splice")
+    {
+        return new SpliceTransport(options.pipe_capacity, largest_payload);
+    }
+    if (options.transport == "shm")
+    {
+        // the ring holds a record of at most half its capacity
+        return new ShmRingTransport(max(options.ring_capacity, 2 * (largest_payload + 8)));
+    }
+
+    return nullptr;
+}
+
+#ifdef HAVE_IO_URING
+/*
+    IoUring class is a minimal io_uring: a submission ring and a completion ring shared with the kernel
+
+    an operation is queued by filling a submission entry, and many are handed to the kernel by a single io_uring_enter
+    the kernel posts a completion for each, with the result a system call would return (-errno on error),
+    and the "user_data" of its submission, to find the operation again
+
+    only this process writes the tail of the submission ring and the head of the completion ring;
+    the kernel writes the others, so they are read with acquire and written with release
+*/
+class IoUring
+{
+private:
+    int ring_fd = -1;
+
+    void *sq_mapping = MAP_FAILED;
+    size_t sq_mapping_size = 0;
+    void *cq_mapping = MAP_FAILED;
+    size_t cq_mapping_size = 0;
+    struct io_uring_sqe *sqes = static_cast<struct io_uring_sqe *>(MAP_FAILED);
+    size_t sqes_size = 0;
+
+    unsigned *sq_head = nullptr;
+    unsigned *sq_tail = nullptr;
+    unsigned *sq_mask = nullptr;
+    unsigned *sq_array = nullptr;
+    unsigned *cq_head = nullptr;
+    unsigned *cq_tail = nullptr;
+    unsigned *cq_mask = nullptr;
+    struct io_uring_cqe *cqes = nullptr;
+
+    // the entries filled since the last submit
+    unsigned queued = 0;
+
+    int enter(unsigned count, unsigned wait)
+    {
+        while (true)
+        {
+            int result = syscall(__NR_io_uring_enter, ring_fd, count, wait, wait > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+            if (result == -1 && errno == EINTR)
+            {
+                continue;
+            }
+            return result;
+        }
+    }
+
+public:
+    unsigned entries = 0;
+
+    ~IoUring()
+    {
+        if (sqes != MAP_FAILED)
+        {
+            munmap(sqes, sqes_size);
+        }
+        if (cq_mapping != MAP_FAILED && cq_mapping != sq_mapping)
+        {
+            munmap(cq_mapping, cq_mapping_size);
+        }
+        if (sq_mapping != MAP_FAILED)
+        {
+            munmap(sq_mapping, sq_mapping_size);
+        }
+        if (ring_fd != -1)
+        {
+            close(ring_fd);
+        }
+    }
+
+    // set up the rings for "count" operations at once; return false, with "errno" set, where io_uring is not available
+    bool setup(unsigned count)
+    {
+        struct io_uring_params params;
+        memset(&params, 0, sizeof(params));
+
+        ring_fd = syscall(__NR_io_uring_setup, count, &params);
+        if (ring_fd == -1)
+        {
+            return false;
+        }
+
+        entries = params.sq_entries;
+        sq_mapping_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_mapping_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+        // a newer kernel maps both rings at once
+        bool single_mapping = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mapping)
+        {
+            sq_mapping_size = cq_mapping_size = max(sq_mapping_size, cq_mapping_size);
+        }
+
+        sq_mapping = mmap(nullptr, sq_mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+        if (sq_mapping == MAP_FAILED)
+        {
+            return false;
+        }
+
+        cq_mapping = single_mapping ? sq_mapping
+                                    : mmap(nullptr, cq_mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+        if (cq_mapping == MAP_FAILED)
+        {
+            return false;
+        }
+
+        sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+        void *mapping = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+        if (mapping == MAP_FAILED)
+        {
+            return false;
+        }
+        sqes = static_cast<struct io_uring_sqe *>(mapping);
+
+        char *sq = static_cast<char *>(sq_mapping);
+        sq_head = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+        sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+        sq_mask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+        sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+
+        char *cq = static_cast<char *>(cq_mapping);
+        cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+        cq_mask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+
+        return true;
+    }
+
+    // whether the kernel knows every one of "operations" (IORING_OP_...); an older kernel without a probe knows none of these
+    bool supports(initializer_list<int> operations)
+    {
+        const unsigned probe_count = 256;
+        vector<char> buffer(sizeof(struct io_uring_probe) + probe_count * sizeof(struct io_uring_probe_op), 0);
+        struct io_uring_probe *probe = reinterpret_cast<struct io_uring_probe *>(buffer.data());
+
+        if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PROBE, probe, probe_count) < 0)
+        {
+            return false;
+        }
+
+        for (int operation : operations)
+        {
+            if (operation > probe->last_op || !(probe->ops[operation].flags & IO_URING_OP_SUPPORTED))
+            {
+                errno = EOPNOTSUPP;
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // the entries filled that the kernel has not taken yet (queued, or left by a submit that took only some)
+    unsigned unsubmitted() const
+    {
+        return *sq_tail + queued - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    }
+
+    // a cleared submission entry to fill, or nullptr while the ring is full: submit (or reap) first
+    struct io_uring_sqe *get_sqe()
+    {
+        unsigned tail = *sq_tail + queued;
+
+        if (tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= entries)
+        {
+            return nullptr;
+        }
+
+        unsigned index = tail & *sq_mask;
+        struct io_uring_sqe *sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sq_array[index] = index;
+        queued++;
+
+        return sqe;
+    }
+
+    /*
+        hand the entries not taken yet to the kernel, and wait for at least "wait" completions
+        return the number of entries taken, which may be fewer than given (the rest stay in the ring, for the next submit),
+        or -1 with "errno" set: EAGAIN or EBUSY when the kernel is short of room, until completions are reaped
+    */
+    int submit(unsigned wait)
+    {
+        __atomic_store_n(sq_tail, *sq_tail + queued, __ATOMIC_RELEASE);
+        queued = 0;
+
+        return enter(*sq_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE), wait);
+    }
+
+    // wait for at least "wait" completions, submitting nothing; return -1 on error, with "errno" set
+    int wait_for(unsigned wait)
+    {
+        return enter(0, wait);
+    }
+
+    // hand every completion posted so far to "handle(user_data, result)"
+    template <typename Handle>
+    void complete(Handle handle)
+    {
+        unsigned head = *cq_head;
+
+        while (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+        {
+            struct io_uring_cqe *cqe = &cqes[head & *cq_mask];
+            uint64_t user_data = cqe->user_data;
+            int result = cqe->res;
+
+            // free the slot before handling, as the handler may queue more operations
+            head++;
+            __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+
+            handle(user_data, result);
+        }
+    }
+};
+
+/*
+    UringWalker class lists a tree like DirectoryWalker, with the system calls around the listing going through io_uring
+
+    a single thread keeps many operations in flight at once:
+    - OPENAT for the directories waiting to be listed, relative to the root
+    - STATX for the entries whose type is unknown, or whose size is asked for
+    - CLOSE for a directory once its entries are looked up
+    - WRITE of the frames of the listing to the pipe, one at a time so they stay in order (with --io-uring and a pipe)
+    the entries themselves are still read with getdents64: io_uring has no operation to read a directory
+
+    the records are those of DirectoryWalker; only their order differs, as the look-ups complete in any order
+*/
+class UringWalker
+{
+public:
+    typedef DirectoryWalker::Sink Sink;
+
+private:
+    // a directory being listed; its descriptor stays open while a look-up of its entries is in flight
+    struct ListedDirectory
+    {
+        string prefix;
+        uint32_t id;
+        int fd = -1;
+        int lookups = 0;
+        bool reading = true;
+    };
+
+    // an operation in flight, found again from the user data of its completion
+    struct Operation
+    {
+        enum Kind
+        {
+            OPEN,
+            STAT,
+            CLOSE,
+            WRITE
+        } kind;
+
+        ListedDirectory *directory = nullptr;
+
+        // OPEN: the path of the directory; STAT: the name of the entry
+        string path;
+        unsigned char type = DT_UNKNOWN;
+        uint64_t inode = 0;
+        struct statx status;
+    };
+
+    IoUring ring;
+
+    /*
+        the operations in flight at most, below the capacity of the completion ring
+        an operation is in flight from the time it is queued in "waiting" until its completion is handled;
+        it goes from "waiting" into the submission ring when there is room (see fill_ring)
+    */
+    unsigned limit = 0;
+    unsigned in_flight = 0;
+    deque<Operation *> waiting;
+
+    size_t batch_size;
+    uint8_t record_fields = 0;
+
+    int root_fd = -1;
+    Sink sink;
+    bool cancelled = false;
+
+    deque<pair<string, uint32_t>> pending_directories;
+    deque<ListedDirectory *> opened_directories;
+    uint32_t next_directory_id = 1;
+    string batch;
+
+    /*
+        the frames waiting to be written to "output_fd", the first one written up to "written"
+        at most MAX_QUEUED_FRAMES: the listing waits for the pipe beyond that, as DirectoryWalker blocks in write
+        (a few more may be added while completions are reaped, one batch of look-ups at most)
+    */
+    static const size_t MAX_QUEUED_FRAMES = 4;
+    int output_fd = -1;
+    deque<string> frames;
+    size_t written = 0;
+    Operation write_operation;
+
+    // set while completions are handled, so a batch filled by them does not wait for more (and reap within the reaping)
+    bool reaping = false;
+
+    // the error that cancelled the walk: of a write, or of io_uring itself
+    int error_number = 0;
+
+    // set once io_uring_enter failed for good: the operations in flight are never reaped
+    bool ring_failed = false;
+
+    // the submits in a row refused for lack of room, with no operation in the kernel to wait for
+    unsigned busy_retries = 0;
+
+    void flush()
+    {
+        if (batch.empty() || cancelled)
+        {
+            batch.clear();
+            return;
+        }
+
+        if (output_fd == -1)
+        {
+            cancelled = !sink(batch.data(), batch.size());
+        }
+        else
+        {
+            // a large directory is read in one go: wait for the pipe here, rather than queue all of it
+            while (frames.size() >= MAX_QUEUED_FRAMES && !reaping && !cancelled)
+            {
+                wait_for_completion();
+            }
+            if (batch.empty() || cancelled)
+            {
+                // emptied by a flush of the completions waited for, or the walk cancelled meanwhile
+                batch.clear();
+                return;
+            }
+
+            most_frames_queued = max(most_frames_queued, frames.size() + 1);
+
+            string frame;
+            append_frame(frame, batch.data(), batch.size());
+            frames.push_back(move(frame));
+
+            write_byte += batch.size();
+            write_frames++;
+
+            if (frames.size() == 1)
+            {
+                write_next();
+            }
+        }
+
+        batch.clear();
+    }
+
+    // write (the rest of) the first frame waiting
+    void write_next()
+    {
+        if (frames.empty())
+        {
+            return;
+        }
+
+        queue(&write_operation);
+    }
+
+    void queue(Operation *operation)
+    {
+        waiting.push_back(operation);
+        in_flight++;
+    }
+
+    // fill a submission entry for "operation"
+    void prepare(struct io_uring_sqe *sqe, Operation *operation)
+    {
+        switch (operation->kind)
+        {
+        case Operation::OPEN:
+            sqe->opcode = IORING_OP_OPENAT;
+            sqe->fd = root_fd;
+            sqe->addr = reinterpret_cast<uint64_t>(operation->path.c_str());
+            sqe->open_flags = O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC;
+            break;
+
+        case Operation::STAT:
+            sqe->opcode = IORING_OP_STATX;
+            sqe->fd = operation->directory->fd;
+            sqe->addr = reinterpret_cast<uint64_t>(operation->path.c_str());
+            sqe->len = STATX_TYPE | STATX_SIZE;
+            sqe->off = reinterpret_cast<uint64_t>(&operation->status);
+            sqe->statx_flags = AT_SYMLINK_NOFOLLOW;
+            break;
+
+        case Operation::CLOSE:
+            sqe->opcode = IORING_OP_CLOSE;
+            sqe->fd = operation->directory->fd;
+            break;
+
+        case Operation::WRITE:
+            sqe->opcode = IORING_OP_WRITE;
+            sqe->fd = output_fd;
+            sqe->addr = reinterpret_cast<uint64_t>(frames.front().data() + written);
+            sqe->len = frames.front().size() - written;
+            break;
+        }
+
+        sqe->user_data = reinterpret_cast<uint64_t>(operation);
+    }
+
+    // move the waiting operations into the submission ring, as far as there is room
+    void fill_ring()
+    {
+        struct io_uring_sqe *sqe;
+        while (!waiting.empty() && (sqe = ring.get_sqe()) != nullptr)
+        {
+            prepare(sqe, waiting.front());
+            waiting.pop_front();
+        }
+    }
+
+    // stop the walk on an error of io_uring itself, reported as a failed write would be
+    void fail_ring()
+    {
+        error_number = errno;
+        ring_failed = true;
+        cancelled = true;
+    }
+
+    void add_record(ListedDirectory &directory, const char *name, size_t length, unsigned char type, uint64_t inode, uint64_t size)
+    {
+        if (directory.prefix.size() + length > MAX_RECORD_NAME)
+        {
+            report_long_path(directory.prefix, length);
+            return;
+        }
+
+        Record record;
+        record.name = name;
+        record.length = length;
+        record.type = type;
+        record.inode = inode;
+        record.size = size;
+        record.parent = directory.id;
+        record.directory_id = 0;
+        record.flags = record_fields & ~(type == DT_DIR ? 0 : RECORD_DIRECTORY_ID);
+
+        if (type == DT_DIR)
+        {
+            record.directory_id = next_directory_id++;
+            pending_directories.push_back(make_pair(directory.prefix + string(name, length), record.directory_id));
+        }
+
+        append_record(batch, record, directory.prefix.data(), directory.prefix.size());
+
+        if (batch.size() >= batch_size)
+        {
+            flush();
+        }
+    }
+
+    // close a directory once it is read and none of its look-ups is in flight
+    void release(ListedDirectory *directory)
+    {
+        if (directory->reading || directory->lookups > 0)
+        {
+            return;
+        }
+
+        Operation *operation = new Operation();
+        operation->kind = Operation::CLOSE;
+        operation->directory = directory;
+        queue(operation);
+    }
+
+    void completed(uint64_t user_data, int result)
+    {
+        Operation *operation = reinterpret_cast<Operation *>(user_data);
+        in_flight--;
+
+        switch (operation->kind)
+        {
+        case Operation::OPEN:
+            if (result < 0)
+            {
+                fprintf(stderr, "Failed to open the directory \"%s\": %s\n", operation->path.c_str(), strerror(-result));
+                delete operation->directory;
+            }
+            else
+            {
+                operation->directory->fd = result;
+                opened_directories.push_back(operation->directory);
+            }
+            break;
+
+        case Operation::STAT:
+        {
+            // a failed look-up keeps the entry, as DirectoryWalker does
+            unsigned char type = operation->type;
+            bool stated = result == 0;
+            if (stated && type == DT_UNKNOWN && S_ISDIR(operation->status.stx_mode))
+            {
+                type = DT_DIR;
+            }
+
+            add_record(*operation->directory, operation->path.data(), operation->path.size(), type, operation->inode,
+                       stated ? operation->status.stx_size : 0);
+
+            operation->directory->lookups--;
+            release(operation->directory);
+            break;
+        }
+
+        case Operation::CLOSE:
+            delete operation->directory;
+            break;
+
+        case Operation::WRITE:
+            if (result < 0 && result != -EINTR && result != -EAGAIN)
+            {
+                error_number = -result;
+                cancelled = true;
+                frames.clear();
+                return;
+            }
+
+            written += max(result, 0);
+            if (written == frames.front().size())
+            {
+                frames.pop_front();
+                written = 0;
+            }
+            write_next();
+            return;
+        }
+
+        delete operation;
+    }
+
+    /*
+        hand the waiting operations to the kernel, wait for one to complete, and handle every completion
+        a kernel short of room (EAGAIN, EBUSY) gets its completions reaped, and the rest is submitted on the next call;
+        any other failure of io_uring_enter, or a kernel short of room for a second with nothing to reap, cancels the walk
+    */
+    void wait_for_completion()
+    {
+        fill_ring();
+
+        if (ring.submit(1) == -1)
+        {
+            if (errno != EAGAIN && errno != EBUSY)
+            {
+                fail_ring();
+                return;
+            }
+
+            // the operations the kernel holds: wait for one of them, or, with none, try again a little later
+            unsigned in_kernel = in_flight - waiting.size() - ring.unsubmitted();
+            if (in_kernel > 0)
+            {
+                if (ring.wait_for(1) == -1 && errno != EAGAIN && errno != EBUSY)
+                {
+                    fail_ring();
+                    return;
+                }
+            }
+            else if (++busy_retries > 1000)
+            {
+                fail_ring();
+                return;
+            }
+            else
+            {
+                usleep(1000);
+            }
+        }
+        else
+        {
+            busy_retries = 0;
+        }
+
+        reaping = true;
+        ring.complete([this](uint64_t user_data, int result)
+                      { completed(user_data, result); });
+        reaping = false;
+    }
+
+    // read a directory opened by io_uring, and queue the look-ups of its entries
+    void read_directory(ListedDirectory *directory)
+    {
+        vector<Operation *> lookups;
+
+        bool success = read_directory_entries(directory->fd, [&](const char *name, size_t length, unsigned char type, uint64_t inode)
+                                              {
+            // hidden entries are not listed, as "ls" does
+            if (name[0] == '.')
+            {
+                return;
+            }
+
+            if (type != DT_UNKNOWN && !(record_fields & RECORD_SIZE))
+            {
+                add_record(*directory, name, length, type, inode, 0);
+                return;
+            }
+
+            Operation *operation = new Operation();
+            operation->kind = Operation::STAT;
+            operation->directory = directory;
+            operation->path.assign(name, length);
+            operation->type = type;
+            operation->inode = inode;
+            lookups.push_back(operation); });
+
+        if (!success)
+        {
+            fprintf(stderr, "Failed to read the directory \"%s\": %s\n", directory->prefix.c_str(), strerror(errno));
+        }
+
+        for (Operation *operation : lookups)
+        {
+            while (in_flight >= limit && !ring_failed)
+            {
+                wait_for_completion();
+            }
+            if (ring_failed)
+            {
+                // never submitted, so free to go
+                delete operation;
+                continue;
+            }
+
+            queue(operation);
+            directory->lookups++;
+        }
+
+        directory->reading = false;
+        release(directory);
+    }
+
+public:
+    // the bytes and frames written by the walk, when writing to a descriptor
+    size_t write_byte = 0;
+    size_t write_frames = 0;
+
+    // the most frames waiting to be written at once
+    size_t most_frames_queued = 0;
+
+    UringWalker(size_t batch_size)
+    {
+        this->batch_size = batch_size;
+        write_operation.kind = Operation::WRITE;
+    }
+
+    // set up io_uring; return false, with "errno" set, where it is not available, or lacks an operation needed
+    bool setup()
+    {
+        if (!ring.setup(256) || !ring.supports({IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_CLOSE, IORING_OP_WRITE}))
+        {
+            return false;
+        }
+
+        limit = ring.entries;
+        return true;
+    }
+
+    void set_record_fields(uint8_t fields)
+    {
+        record_fields = fields;
+    }
+
+    // write every batch as a frame to "fd" through io_uring, instead of handing it to the sink
+    void write_frames_to(int fd)
+    {
+        output_fd = fd;
+    }
+
+    // the error that cancelled the walk (of a write, or of io_uring), or 0
+    int error() const
+    {
+        return error_number;
+    }
+
+    // walk the tree under "root"; return false if "root" cannot be opened, or the walk was cancelled
+    bool walk(const string &root, Sink sink)
+    {
+        root_fd = open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+        if (root_fd == -1)
+        {
+            fprintf(stderr, "Failed to open the directory \"%s\": %s\n", root.c_str(), strerror(errno));
+            return false;
+        }
+
+        this->sink = sink;
+        pending_directories.push_back(make_pair(string(), 0u));
+
+        while (!cancelled)
+        {
+            while (!opened_directories.empty() && !cancelled)
+            {
+                ListedDirectory *directory = opened_directories.front();
+                opened_directories.pop_front();
+                read_directory(directory);
+            }
+
+            // open more directories, unless the pipe is behind on the frames already listed
+            while (!pending_directories.empty() && in_flight < limit && frames.size() < MAX_QUEUED_FRAMES && !cancelled)
+            {
+                Operation *operation = new Operation();
+                operation->kind = Operation::OPEN;
+                operation->path = pending_directories.front().first.empty() ? "." : pending_directories.front().first;
+                operation->directory = new ListedDirectory();
+                operation->directory->prefix = pending_directories.front().first.empty() ? "" : pending_directories.front().first + "/";
+                operation->directory->id = pending_directories.front().second;
+                pending_directories.pop_front();
+                queue(operation);
+            }
+
+            if (in_flight == 0 && opened_directories.empty())
+            {
+                if (pending_directories.empty())
+                {
+                    break;
+                }
+                continue;
+            }
+
+            wait_for_completion();
+        }
+
+        flush();
+
+        /*
+            let every operation in flight complete (the kernel may still use their memory), and the last frames be written
+            once io_uring failed, the ones the kernel holds are left (leaked) rather than freed under it
+        */
+        while (in_flight > 0 && !ring_failed)
+        {
+            wait_for_completion();
+        }
+
+        // the directories opened but not read, after a cancelled walk
+        for (ListedDirectory *directory : opened_directories)
+        {
+            close(directory->fd);
+            delete directory;
+        }
+        opened_directories.clear();
+
+        close(root_fd);
+        root_fd = -1;
+
+        return !cancelled;
+    }
+};
+#endif
+
+/*
+    walk "root" for the listing, handing every batch to "sink", as every mode listing a directory does
+    with --io-uring, where io_uring is available, the walk is UringWalker, and DirectoryWalker otherwise
+    (or when the batches must keep to a directory each, which only DirectoryWalker does)
+*/
+bool walk_listing(const string &root, const PipelineOptions &options, DirectoryWalker::Sink sink, bool group_by_directory = false)
+{
+    if (options.io_uring && !group_by_directory)
+    {
+#ifdef HAVE_IO_URING
+        UringWalker walker(BUFFER_SIZE);
+
+        if (walker.setup())
+        {
+            walker.set_record_fields(options.record_fields);
+            bool success = walker.walk(root, sink);
+
+            if (walker.error())
+            {
+                errno = walker.error();
+                report_io_error();
+            }
+            return success;
+        }
+
+        fprintf(stderr, "io_uring is not available (%s): listing with the synchronous walker\n", strerror(errno));
+#else
+        fprintf(stderr, "io_uring is not available: listing with the synchronous walker\n");
+#endif
+    }
+
+    DirectoryWalker walker(walker_thread_count(), BUFFER_SIZE, group_by_directory);
+    walker.set_record_fields(options.record_fields);
+
+    return walker.walk(root, sink);
+}
+
+/*
+    list "root" into the transport, as the producer of the pipeline; return false for an incomplete listing
+    with --io-uring, a transport writing to a descriptor (a pipe or a socket) gets its frames written by UringWalker itself
+*/
+bool produce_listing(const string &root, Transport *transport, const PipelineOptions &options, size_t &write_byte,
+                     size_t &write_frames, bool &failed)
+{
+    // each batch from the walker is sent as a frame, as soon as it is ready
+    auto send = [&](const char *batch, size_t length)
+    {
+        if (!transport->send(batch, length))
+        {
+            // handle errors gracefully
+            report_io_error();
+            failed = true;
+            return false;
+        }
+
+        write_byte += length;
+        write_frames++;
+        return true;
+    };
+
+#ifdef HAVE_IO_URING
+    if (options.io_uring && transport->stream_fd() != -1)
+    {
+        UringWalker walker(BUFFER_SIZE);
+
+        if (walker.setup())
+        {
+            walker.set_record_fields(options.record_fields);
+            walker.write_frames_to(transport->stream_fd());
+
+            bool success = walker.walk(root, send);
+
+            if (walker.error())
+            {
+                errno = walker.error();
+                report_io_error();
+                failed = true;
+            }
+
+            write_byte += walker.write_byte;
+            write_frames += walker.write_frames;
+            return success;
+        }
+
+        fprintf(stderr, "io_uring is not available (%s): listing with the synchronous walker\n", strerror(errno));
+
+        PipelineOptions synchronous = options;
+        synchronous.io_uring = false;
+        return walk_listing(root, synchronous, send);
+    }
+#endif
+
+    return walk_listing(root, options, send);
+}
+
+// implement Ordinary Pipe (or Shared Memory) and Producer-Consumer pattern
+void pipeline(string parent_process, CustomGrep child_process, PipelineOptions options)
+{
+    // SIGPIE: a signal, which notifies a process that the pipe it is attempting to write to is closed
+    // It terminates the process by default, since this occurrence may be considered as a broken pipe
+    // To gracefully handle such error, first ignore the SIGPIE
+    signal(SIGPIPE, SIG_IGN);
+
+    time_start = chrono::steady_clock::now();
+
+    unique_ptr<Transport> transport(create_transport(options));
+
+    if (!transport)
+    {
+        fprintf(stderr, "\nUnknown Transport: %s\n", options.transport.c_str());
+        return;
+    }
+
+    // create the pipe (or the shared memory)
+    if (!transport->open())
+    {
+        return;
+    }
+
+    // fork a child process
+    pid_t pid = fork();
+
+    // IF failed to create a child process, THEN terminate the program
+    if (pid < 0)
+    {
+        fprintf(stderr, "\nFork Failed\n");
+        return;
+    }
+
+    /* Parent process (Producer)*/
+    if (pid > 0)
+    {
+        printf("Parent Process PID: %d\n", getpid());
+        fflush(stdout);
+
+        transport->producer_side();
+
+        size_t write_byte = 0;
+        size_t write_frames = 0;
+        bool failed = false;
+
+        // parent process produces an output by listing "~/[path]" directory
+        bool success = produce_listing(parent_process, transport.get(), options, write_byte, write_frames, failed);
+
+        // mark the end of the stream only for a complete listing
+        if (success && !failed && !transport->finish())
+        {
+            report_io_error();
+        }
+
+        printf("WRITE: %zu bytes in %zu frames through %s\n\n", write_byte, write_frames, transport->name());
+
+        // close the write end of the pipe
+        transport.reset();
+
+        // wait for the child process to display its result
+        waitpid(pid, nullptr, 0);
+    }
+    /* Child process (Consumer)*/
+    else
+    {
+        printf("Child Process PID: %d\n", getpid());
+
+        transport->consumer_side();
+
+        const char *read_msg;
+        size_t length;
+        size_t read_byte = 0;
+        size_t read_frames = 0;
+        int status;
+
+        // child process consumes the listing frame by frame, as it arrives
+        while ((status = transport->receive(read_msg, length)) == 1)
+        {
+            child_process.grep_batch(read_msg, length);
+            read_byte += length;
+            read_frames++;
+        }
+
+        // handle errors gracefully
+        if (status == -1)
+        {
+            report_io_error();
+        }
+
+        printf("\nREAD: %zu bytes in %zu frames through %s\n", read_byte, read_frames, transport->name());
+
+        // close the read end of the pipe
+        transport.reset();
+
+        // collect a end time for the program
+        auto time_end = chrono::steady_clock::now();
+
+        // calculate estimated excution time for the program, to the microsecond
+        chrono::duration<double, milli> execution_time = time_end - time_start;
+
+        // display the estimated execution time
+        printf("\nEstimated Data Transmission Time: %.3f milliseconds (ms)\n\n", execution_time.count());
+
+        // child process concludes the search
+        child_process.report();
+
+        exit(status == 0 ? 0 : 1);
+    }
+
+    return;
+}
+
+/*
+    Fan-out of the pipeline across several consumer processes
+
+    the parent forks one consumer per core, each with its own transport, and deals the frames of the listing out:
+    - "round-robin": frame after frame, to the consumers in turn
+    - "directory": every frame holds a single directory, and a directory always goes to the same consumer
+
+    every frame carries a sequence number ahead of the batch
+    each consumer sends its matches back through a result pipe of its own, as frames of "[sequence][hit][hit]...",
+    where a hit is "[pattern id][length][file]"; a hit is never split across two frames
+    the hits of a batch go in one frame, or, when there are many, in several frames with MORE_RESULTS set but the last
+    a thread of the parent merges the result pipes, and displays the hits as they come, or in the order of the listing
+*/
+typedef uint64_t SequenceNumber;
+
+// the sequence number a consumer sends once it has consumed its whole stream
+const SequenceNumber CONSUMER_DONE = UINT64_MAX;
+
+// set in the sequence number of a result frame followed by more hits of the same batch
+const SequenceNumber MORE_RESULTS = SequenceNumber(1) << 63;
+
+// the work of a consumer process: match every frame of its stream, and send the hits back
+int fan_out_consumer(Transport *transport, int result_fd)
+{
+    const char *read_msg;
+    size_t length;
+    string results;
+    int status;
+
+    while ((status = transport->receive(read_msg, length)) == 1)
+    {
+        SequenceNumber sequence;
+        memcpy(&sequence, read_msg, sizeof(sequence));
+
+        results.assign(reinterpret_cast<const char *>(&sequence), sizeof(sequence));
+        bool failed = false;
+
+        CustomGrep::match_batch(read_msg + sizeof(sequence), length - sizeof(sequence), [&](const char *file, size_t file_length, uint32_t id)
+                                {
+            // many hits (e.g. many patterns matching every file) go out in several frames, cut between two hits
+            if (results.size() >= size_t(BUFFER_SIZE) && !failed)
+            {
+                SequenceNumber more = sequence | MORE_RESULTS;
+                memcpy(&results[0], &more, sizeof(more));
+                failed = !write_frame(result_fd, results.data(), results.size());
+                results.assign(reinterpret_cast<const char *>(&sequence), sizeof(sequence));
+            }
+
+            uint32_t hit[2] = {id, static_cast<uint32_t>(file_length)};
+            results.append(reinterpret_cast<const char *>(hit), sizeof(hit));
+            results.append(file, file_length); });
+
+        if (failed || !write_frame(result_fd, results.data(), results.size()))
+        {
+            report_io_error();
+            return 1;
+        }
+    }
+
+    // handle errors gracefully
+    if (status == -1)
+    {
+        report_io_error();
+    }
+
+    SequenceNumber done = CONSUMER_DONE;
+    if (!write_frame(result_fd, reinterpret_cast<const char *>(&done), sizeof(done)))
+    {
+        return 1;
+    }
+
+    return status == 0 ? 0 : 1;
+}
+
+// display every hit of a result frame; a hit cut short (by a corrupt frame) is dropped, not read past the frame
+void display_results(const char *hits, size_t length)
+{
+    const char *end = hits + length;
+    uint32_t hit[2];
+
+    while (size_t(end - hits) >= sizeof(hit))
+    {
+        memcpy(hit, hits, sizeof(hit));
+        if (hit[1] > size_t(end - hits) - sizeof(hit) || hit[0] >= CustomGrep::pattern_count())
+        {
+            fprintf(stderr, "\nCorrupt Result Frame: a hit runs past the end of its frame\n");
+            return;
+        }
+
+        CustomGrep::display(hits + sizeof(hit), hit[1], hit[0]);
+        hits += sizeof(hit) + hit[1];
+    }
+}
+
+/*
+    merge the result pipes of the consumers, until every one of them is done
+    return false if a consumer ended without its end mark (it died, and its results are lost);
+    in order, the batches held back behind its missing ones are then displayed as they are, in the order of the listing
+*/
+bool merge_results(vector<int> result_fds, bool ordered)
+{
+    vector<unique_ptr<FrameReader>> readers;
+    vector<struct pollfd> polled;
+    for (int fd : result_fds)
+    {
+        readers.push_back(unique_ptr<FrameReader>(new FrameReader(fd, 4 * PIPE_BUF)));
+        polled.push_back({fd, POLLIN, 0});
+    }
+
+    // for an ordered merge: the hits of batches that arrived ahead of their turn, and whether each is complete
+    map<SequenceNumber, pair<string, bool>> waiting;
+    SequenceNumber next_sequence = 0;
+
+    size_t running = result_fds.size();
+    bool complete_results = true;
+
+    while (running > 0)
+    {
+        if (poll(polled.data(), polled.size(), -1) == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            report_io_error();
+            return false;
+        }
+
+        for (size_t i = 0; i < polled.size(); i++)
+        {
+            if (polled[i].fd == -1 || polled[i].revents == 0)
+            {
+                continue;
+            }
+
+            // take every frame the consumer has sent so far, read or still buffered
+            do
+            {
+                const char *message;
+                size_t length;
+
+                if (readers[i]->next(message, length) != 1)
+                {
+                    // a consumer that died is done as well, but the results of its batches are missing
+                    fprintf(stderr, "\nConsumer %zu Failed: its results ended before its end mark\n", i + 1);
+                    complete_results = false;
+                    polled[i].fd = -1;
+                    running--;
+                    break;
+                }
+
+                SequenceNumber sequence;
+                memcpy(&sequence, message, sizeof(sequence));
+
+                if (sequence == CONSUMER_DONE)
+                {
+                    polled[i].fd = -1;
+                    running--;
+                    break;
+                }
+
+                // every frame holds whole hits, so it is displayed on its own
+                if (!ordered)
+                {
+                    display_results(message + sizeof(sequence), length - sizeof(sequence));
+                    continue;
+                }
+
+                bool complete = !(sequence & MORE_RESULTS);
+                pair<string, bool> &batch = waiting[sequence & ~MORE_RESULTS];
+                batch.first.append(message + sizeof(sequence), length - sizeof(sequence));
+                batch.second = complete;
+
+                // display every batch whose turn has come, once all of its hits arrived
+                while (!waiting.empty() && waiting.begin()->first == next_sequence && waiting.begin()->second.second)
+                {
+                    const string &hits = waiting.begin()->second.first;
+                    display_results(hits.data(), hits.size());
+                    waiting.erase(waiting.begin());
+                    next_sequence++;
+                }
+            } while (readers[i]->has_buffered_frame());
+        }
+    }
+
+    // the batches held back behind a missing one: shown rather than dropped
+    if (!waiting.empty())
+    {
+        fprintf(stderr, "\nIncomplete Results: batch %llu is missing; the %zu batch(es) after it follow without it\n",
+                (unsigned long long)next_sequence, waiting.size());
+        for (const auto &batch : waiting)
+        {
+            display_results(batch.second.first.data(), batch.second.first.size());
+        }
+        complete_results = false;
+    }
+
+    return complete_results;
+}
+
+/*
+    implement Ordinary Pipe (or Shared Memory) and Producer-Consumer pattern, with several consumers
+    return false if it could not start, or the results of a consumer were lost
+*/
+bool fan_out_pipeline(string parent_process, CustomGrep child_process, PipelineOptions options)
+{
+    signal(SIGPIPE, SIG_IGN);
+
+    time_start = chrono::steady_clock::now();
+
+    int consumers = options.consumers > 0 ? options.consumers : walker_thread_count();
+    bool by_directory = options.split == "directory";
+
+    if (!by_directory && options.split != "round-robin")
+    {
+        fprintf(stderr, "\nUnknown Split: %s\n", options.split.c_str());
+        return false;
+    }
+
+    // one transport for each consumer (the result pipes follow)
+    vector<unique_ptr<Transport>> transports;
+    for (int i = 0; i < consumers; i++)
+    {
+        transports.push_back(unique_ptr<Transport>(create_transport(options, sizeof(SequenceNumber))));
+
+        if (!transports.back())
+        {
+            fprintf(stderr, "\nUnknown Transport: %s\n", options.transport.c_str());
+            return false;
+        }
+        if (!transports.back()->open())
+        {
+            return false;
+        }
+    }
+
+    // a result pipe for each consumer
+    vector<int> result_fds;
+    vector<int> result_write_fds;
+    for (int i = 0; i < consumers; i++)
+    {
+        int result_fd[2];
+        if (pipe(result_fd) == -1)
+        {
+            fprintf(stderr, "\nPipe Creation Failed\n");
+            return false;
+        }
+        result_fds.push_back(result_fd[READ_END]);
+        result_write_fds.push_back(result_fd[WRITE_END]);
+    }
+
+    printf("Parent Process PID: %d\n", getpid());
+    fflush(stdout);
+
+    vector<pid_t> pids;
+    for (int i = 0; i < consumers; i++)
+    {
+        pid_t pid = fork();
+
+        if (pid < 0)
+        {
+            fprintf(stderr, "\nFork Failed\n");
+            break;
+        }
+
+        /* Child process (Consumer)*/
+        if (pid == 0)
+        {
+            printf("Child Process PID: %d (consumer %d of %d)\n", getpid(), i + 1, consumers);
+            fflush(stdout);
+
+            // keep only the own side of the own transport, and the write end of the own result pipe
+            for (int j = 0; j < consumers; j++)
+            {
+                if (j != i)
+                {
+                    transports[j].reset();
+                    close(result_write_fds[j]);
+                }
+                close(result_fds[j]);
+            }
+            transports[i]->consumer_side();
+
+            int status = fan_out_consumer(transports[i].get(), result_write_fds[i]);
+
+            close(result_write_fds[i]);
+            exit(status);
+        }
+
+        pids.push_back(pid);
+    }
+
+    /* Parent process (Producer)*/
+    for (int i = 0; i < consumers; i++)
+    {
+        close(result_write_fds[i]);
+    }
+
+    // consumers that could not be forked are dropped
+    consumers = pids.size();
+    for (size_t i = consumers; i < result_fds.size(); i++)
+    {
+        close(result_fds[i]);
+    }
+    result_fds.resize(consumers);
+
+    for (int i = 0; i < consumers; i++)
+    {
+        transports[i]->producer_side();
+    }
+
+    // the results are merged on a thread of their own, so a full result pipe never blocks the producer
+    bool merged = true;
+    thread merger([&merged, result_fds, &options]
+                  { merged = merge_results(result_fds, options.ordered); });
+
+    size_t write_byte = 0;
+    SequenceNumber sequence = 0;
+    bool failed = false;
+
+    bool success = walk_listing(parent_process, options, [&](const char *batch, size_t length)
+                                {
+        int consumer = sequence % consumers;
+
+        // the directory of a batch is the path of its first file, up to the last slash (/)
+        Record first;
+        if (by_directory && read_record(batch, batch + length, first))
+        {
+            size_t directory_length = 0;
+            for (size_t i = 0; i < first.length; i++)
+            {
+                if (first.name[i] == '/')
+                {
+                    directory_length = i;
+                }
+            }
+            consumer = hash<string>()(string(first.name, directory_length)) % consumers;
+        }
+
+        char *frame = transports[consumer]->reserve(sizeof(sequence) + length);
+        if (frame)
+        {
+            memcpy(frame, &sequence, sizeof(sequence));
+            memcpy(frame + sizeof(sequence), batch, length);
+        }
+
+        if (!frame || !transports[consumer]->commit(sizeof(sequence) + length))
+        {
+            // handle errors gracefully
+            report_io_error();
+            failed = true;
+            return false;
+        }
+
+        write_byte += length;
+        sequence++;
+        return true; }, by_directory);
+
+    for (int i = 0; i < consumers; i++)
+    {
+        // mark the end of the stream only for a complete listing
+        if (success && !failed && !transports[i]->finish())
+        {
+            report_io_error();
+        }
+        transports[i].reset();
+    }
+
+    printf("WRITE: %zu bytes in %llu frames to %d consumers\n", write_byte, (unsigned long long)sequence, consumers);
+
+    merger.join();
+    for (int fd : result_fds)
+    {
+        close(fd);
+    }
+
+    for (pid_t pid : pids)
+    {
+        waitpid(pid, nullptr, 0);
+    }
+
+    // collect a end time for the program
+    auto time_end = chrono::steady_clock::now();
+
+    // calculate estimated excution time for the program, to the microsecond
+    chrono::duration<double, milli> execution_time = time_end - time_start;
+
+    // display the estimated execution time
+    printf("\nEstimated Data Transmission Time: %.3f milliseconds (ms)\n\n", execution_time.count());
+
+    // conclude the search
+    child_process.report();
+    return merged;
+}
+
+/*
+    Stages of a longer pipeline, e.g. --pipeline="grep:foo|sort|dedupe@fork|count"
+
+    the listing flows from one stage to the next as frames of records, as through the plain pipeline
+    a stage takes the records one by one, and hands on the ones it keeps (at once, or at the end of the stream)
+*/
+class Stage
+{
+public:
+    // hand a record on to the next stage
+    typedef function<void(const char *record, size_t size)> Emit;
+
+    virtual ~Stage() {}
+
+    // take the record "record" of "size" bytes, parsed into "fields"
+    virtual void push(const char *record, size_t size, const Record &fields, const Emit &emit) = 0;
+
+    // the end of the stream: hand on whatever was held back
+    virtual void finish(const Emit &) {}
+};
+
+// "grep[:NAMES]": keep the records matching any of the names (or globs), as CustomGrep does
+class GrepStage : public Stage
+{
+private:
+    PatternMatcher matcher;
+
+public:
+    GrepStage(const vector<string> &patterns)
+    {
+        for (const string &pattern : patterns)
+        {
+            matcher.add(pattern);
+        }
+        matcher.compile();
+    }
+
+    void push(const char *record, size_t size, const Record &, const Emit &emit)
+    {
+        bool matched = false;
+        matcher.match(record, size, [&](const char *, size_t, uint32_t)
+                      { matched = true; });
+
+        if (matched)
+        {
+            emit(record, size);
+        }
+    }
+};
+
+// "sort": hand on the records in the byte order of their paths, once all of them arrived
+class SortStage : public Stage
+{
+private:
+    // the path of each record, and the record itself
+    vector<pair<string, string>> held;
+
+public:
+    void push(const char *record, size_t size, const Record &fields, const Emit &)
+    {
+        held.emplace_back(string(fields.name, fields.length), string(record, size));
+    }
+
+    void finish(const Emit &emit)
+    {
+        sort(held.begin(), held.end());
+
+        for (const auto &entry : held)
+        {
+            emit(entry.second.data(), entry.second.size());
+        }
+
+        held.clear();
+    }
+};
+
+// "dedupe": keep the first record of each file name (the part of the path after the last slash)
+class DedupeStage : public Stage
+{
+private:
+    unordered_set<string> seen;
+
+public:
+    void push(const char *record, size_t size, const Record &fields, const Emit &emit)
+    {
+        const char *file_name = fields.name + fields.length;
+        while (file_name > fields.name && file_name[-1] != '/')
+        {
+            file_name--;
+        }
+
+        if (seen.insert(string(file_name, fields.name + fields.length - file_name)).second)
+        {
+            emit(record, size);
+        }
+    }
+};
+
+// "count": hand on a single record, named after the number of records that arrived
+class CountStage : public Stage
+{
+private:
+    size_t count = 0;
+
+public:
+    void push(const char *, size_t, const Record &, const Emit &)
+    {
+        count++;
+    }
+
+    void finish(const Emit &emit)
+    {
+        string name = to_string(count);
+        Record record = {name.data(), name.size(), DT_UNKNOWN, 0, 0, 0, 0, 0};
+
+        string out;
+        append_record(out, record, "", 0);
+        emit(out.data(), out.size());
+    }
+};
+
+// the last stage, always in this process: display the path of every record
+class PrintStage : public Stage
+{
+public:
+    size_t printed = 0;
+
+    void push(const char *, size_t, const Record &fields, const Emit &)
+    {
+        fwrite(fields.name, 1, fields.length, stdout);
+        putchar('\n');
+        printed++;
+    }
+};
+
+// create the stage described by "spec"; a "grep" with no names of its own seeks for the names typed in
+Stage *create_stage(const StageSpec &spec, const vector<string> &seeking_files)
+{
+    if (spec.kind == "grep")
+    {
+        vector<string> patterns;
+        stringstream names(spec.argument);
+        string name;
+        while (names >> name)
+        {
+            patterns.push_back(name);
+        }
+
+        return new GrepStage(spec.argument.empty() ? seeking_files : patterns);
+    }
+    if (spec.kind == "sort")
+    {
+        return new SortStage();
+    }
+    if (spec.kind == "dedupe")
+    {
+        return new DedupeStage();
+    }
+    if (spec.kind == "count")
+    {
+        return new CountStage();
+    }
+
+    return nullptr;
+}
+
+/*
+    StageChain class runs consecutive stages of one process, handing each record on by a call
+    the records out of the last stage are batched into frames, in "output", for the pipe to the next process
+*/
+class StageChain
+{
+private:
+    vector<unique_ptr<Stage>> stages;
+
+    // emits[k] hands a record from stage k on to stage k + 1
+    vector<Stage::Emit> emits;
+
+    // the records out of the last stage, not yet in a frame
+    string batch;
+
+    void deliver(size_t k, const char *record, size_t size)
+    {
+        if (k == stages.size())
+        {
+            batch.append(record, size);
+            if (batch.size() >= size_t(BUFFER_SIZE))
+            {
+                flush_batch();
+            }
+            return;
+        }
+
+        Record fields;
+        read_record(record, record + size, fields);
+        stages[k]->push(record, size, fields, emits[k]);
+    }
+
+    void flush_batch()
+    {
+        if (batch.empty())
+        {
+            return;
+        }
+
+        append_frame(output, batch.data(), batch.size());
+        batch.clear();
+    }
+
+public:
+    // the frames ready for the pipe to the next process
+    string output;
+
+    // the chain calls back into itself, so it stays where it was created
+    StageChain() {}
+    StageChain(const StageChain &) = delete;
+
+    void add(Stage *stage)
+    {
+        size_t k = stages.size();
+        stages.push_back(unique_ptr<Stage>(stage));
+        emits.push_back([this, k](const char *record, size_t size)
+                        { deliver(k + 1, record, size); });
+    }
+
+    Stage *last() const
+    {
+        return stages.back().get();
+    }
+
+    // run the records of a frame through the stages
+    void push_frame(const char *data, size_t length)
+    {
+        const char *end = data + length;
+        const char *position = data;
+        const char *next;
+        Record fields;
+
+        while ((next = read_record(position, end, fields)) != nullptr)
+        {
+            stages[0]->push(position, next - position, fields, emits[0]);
+            position = next;
+        }
+
+        flush_batch();
+    }
+
+    // the end of the stream: let every stage hand on what it held back, in order, then mark the end for the next process
+    void finish(bool end_frame)
+    {
+        for (size_t k = 0; k < stages.size(); k++)
+        {
+            stages[k]->finish(emits[k]);
+        }
+        flush_batch();
+
+        if (end_frame)
+        {
+            append_frame(output, nullptr, 0);
+        }
+    }
+};
+
+#ifdef __linux__
+/*
+    a run of stages in one process, between the pipe it reads and the pipe it writes
+    the last one has no pipe to write: its last stage displays the names
+*/
+struct StageSegment
+{
+    unique_ptr<StageChain> chain;
+    bool forked = false;
+    pid_t pid = 0;
+
+    int in_fd = -1;
+    int out_fd = -1;
+    unique_ptr<FrameReader> reader;
+
+    // how much of "chain->output" is written already
+    size_t sent = 0;
+
+    // whether the pipes are watched by epoll
+    bool reading = false;
+    bool writing = false;
+
+    bool input_done = false;
+};
+
+// the output a segment in this process may keep waiting for its pipe, before it stops reading its input
+const size_t EDGE_LIMIT = 4 * BUFFER_SIZE;
+
+// write what the pipe takes of the output of "segment", without blocking; return false on error
+bool flush_segment(StageSegment &segment)
+{
+    string &output = segment.chain->output;
+
+    while (segment.sent < output.size())
+    {
+        ssize_t write_byte = write(segment.out_fd, output.data() + segment.sent, output.size() - segment.sent);
+
+        if (write_byte == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN)
+            {
+                break;
+            }
+            return false;
+        }
+
+        segment.sent += write_byte;
+    }
+
+    if (segment.sent == output.size())
+    {
+        output.clear();
+        segment.sent = 0;
+    }
+
+    return true;
+}
+
+// run the frames read so far through the stages, while the output has room for them
+void feed_segment(StageSegment &segment)
+{
+    const char *data = nullptr;
+    size_t length = 0;
+
+    while (!segment.input_done && segment.chain->output.size() < EDGE_LIMIT && segment.reader->has_buffered_frame())
+    {
+        if (segment.reader->next(data, length) == 0)
+        {
+            segment.input_done = true;
+            segment.chain->finish(segment.out_fd != -1);
+        }
+        else
+        {
+            segment.chain->push_frame(data, length);
+        }
+    }
+}
+
+// watch the pipes of "segment" for what it can do next: read while its output has room, write while it has output
+void watch_segment(int epoll_fd, StageSegment &segment, size_t index)
+{
+    bool read_wanted = !segment.input_done && segment.chain->output.size() < EDGE_LIMIT;
+    bool write_wanted = segment.out_fd != -1 && !segment.chain->output.empty();
+
+    if (read_wanted != segment.reading)
+    {
+        struct epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.u64 = 2 * index;
+        epoll_ctl(epoll_fd, read_wanted ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, segment.in_fd, &event);
+        segment.reading = read_wanted;
+    }
+
+    if (write_wanted != segment.writing)
+    {
+        struct epoll_event event = {};
+        event.events = EPOLLOUT;
+        event.data.u64 = 2 * index + 1;
+        epoll_ctl(epoll_fd, write_wanted ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, segment.out_fd, &event);
+        segment.writing = write_wanted;
+    }
+}
+
+// a forked segment: read, run and write with blocking calls, as the consumer of the plain pipeline does
+void run_forked_segment(StageSegment &segment)
+{
+    FrameReader reader(segment.in_fd, 2 * BUFFER_SIZE);
+    const char *data;
+    size_t length;
+    int status;
+
+    while ((status = reader.next(data, length)) == 1)
+    {
+        segment.chain->push_frame(data, length);
+
+        if (!write_all(segment.out_fd, segment.chain->output.data(), segment.chain->output.size()))
+        {
+            report_io_error();
+            _exit(1);
+        }
+        segment.chain->output.clear();
+    }
+
+    if (status == -1)
+    {
+        report_io_error();
+        _exit(1);
+    }
+
+    segment.chain->finish(true);
+
+    if (!write_all(segment.out_fd, segment.chain->output.data(), segment.chain->output.size()))
+    {
+        report_io_error();
+        _exit(1);
+    }
+
+    _exit(0);
+}
+#endif
+
+/*
+    run the listing through the stages of --pipeline, instead of the two fixed processes
+
+    - a stage runs in this process, or "@fork"-ed into a process of its own, to keep another core busy
+    - consecutive stages of this process are chained by calls; a pipe joins each process to the next
+    - the walker writes the listing into the first pipe from a thread, and this process displays what comes out
+
+    the stages of this process are driven by an epoll loop, over non-blocking pipes
+    each keeps at most EDGE_LIMIT bytes of output waiting for its pipe: past that, it stops reading its input
+    until the pipe drains, so a slow stage holds back the ones before it (a forked stage blocks on its pipes instead)
+    the memory of the pipeline stays bounded that way, except for what a stage holds itself ("sort", "dedupe")
+*/
+void stage_pipeline(string parent_process, vector<string> seeking_files, PipelineOptions options)
+{
+#ifdef __linux__
+    signal(SIGPIPE, SIG_IGN);
+
+    time_start = chrono::steady_clock::now();
+
+    // group the stages into segments: each forked stage on its own, the others with their neighbours
+    vector<StageSegment> segments;
+    for (const StageSpec &spec : options.stages)
+    {
+        Stage *stage = create_stage(spec, seeking_files);
+        if (!stage)
+        {
+            fprintf(stderr, "\nUnknown Stage: %s\n", spec.kind.c_str());
+            return;
+        }
+
+        if (spec.forked || segments.empty() || segments.back().forked)
+        {
+            segments.emplace_back();
+            segments.back().chain.reset(new StageChain());
+            segments.back().forked = spec.forked;
+        }
+        segments.back().chain->add(stage);
+    }
+
+    // the names are displayed by this process
+    if (segments.empty() || segments.back().forked)
+    {
+        segments.emplace_back();
+        segments.back().chain.reset(new StageChain());
+    }
+    PrintStage *printer = new PrintStage();
+    segments.back().chain->add(printer);
+
+    // a pipe in front of every segment; the first one is fed by the walker
+    vector<int> pipe_fds;
+    int source_fd = -1;
+    for (size_t i = 0; i < segments.size(); i++)
+    {
+        int fd[2];
+        if (pipe(fd) == -1)
+        {
+            fprintf(stderr, "\nPipe Creation Failed\n");
+            for (int open_fd : pipe_fds)
+            {
+                close(open_fd);
+            }
+            return;
+        }
+
+        pipe_fds.push_back(fd[READ_END]);
+        pipe_fds.push_back(fd[WRITE_END]);
+
+        segments[i].in_fd = fd[READ_END];
+        if (i == 0)
+        {
+            source_fd = fd[WRITE_END];
+        }
+        else
+        {
+            segments[i - 1].out_fd = fd[WRITE_END];
+        }
+    }
+
+    printf("Parent Process PID: %d\n", getpid());
+    fflush(stdout);
+
+    // fork the forked segments before the walker starts any thread
+    for (StageSegment &segment : segments)
+    {
+        if (!segment.forked)
+        {
+            continue;
+        }
+
+        segment.pid = fork();
+
+        if (segment.pid < 0)
+        {
+            fprintf(stderr, "\nFork Failed\n");
+            break;
+        }
+
+        if (segment.pid == 0)
+        {
+            // keep only the pipes of this segment
+            for (int open_fd : pipe_fds)
+            {
+                if (open_fd != segment.in_fd && open_fd != segment.out_fd)
+                {
+                    close(open_fd);
+                }
+            }
+
+            run_forked_segment(segment);
+        }
+    }
+
+    // this process keeps the pipes of its own segments, and the one into the first segment
+    for (StageSegment &segment : segments)
+    {
+        if (segment.forked)
+        {
+            close(segment.in_fd);
+            close(segment.out_fd);
+            segment.in_fd = segment.out_fd = -1;
+            continue;
+        }
+
+        fcntl(segment.in_fd, F_SETFL, fcntl(segment.in_fd, F_GETFL) | O_NONBLOCK);
+        if (segment.out_fd != -1)
+        {
+            fcntl(segment.out_fd, F_SETFL, fcntl(segment.out_fd, F_GETFL) | O_NONBLOCK);
+        }
+        segment.reader.reset(new FrameReader(segment.in_fd, 2 * BUFFER_SIZE));
+    }
+
+    // the walker produces into the first pipe, blocking while the pipe is full
+    size_t write_byte = 0;
+    size_t write_frames = 0;
+
+    thread producer([&]
+                    {
+        bool failed = false;
+        bool success = walk_listing(parent_process, options, [&](const char *batch, size_t length)
+                                    {
+            if (!write_frame(source_fd, batch, length))
+            {
+                report_io_error();
+                failed = true;
+                return false;
+            }
+
+            write_byte += length;
+            write_frames++;
+            return true; });
+
+        // mark the end of the stream only for a complete listing
+        if (success && !failed && !write_end_frame(source_fd))
+        {
+            report_io_error();
+        }
+
+        close(source_fd); });
+
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    size_t running = 0;
+
+    for (size_t i = 0; i < segments.size(); i++)
+    {
+        if (!segments[i].forked)
+        {
+            watch_segment(epoll_fd, segments[i], i);
+            running++;
+        }
+    }
+
+    bool failed = epoll_fd == -1;
+    struct epoll_event events[16];
+
+    while (running > 0 && !failed)
+    {
+        int ready = epoll_wait(epoll_fd, events, 16, -1);
+
+        if (ready == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            failed = true;
+            break;
+        }
+
+        for (int e = 0; e < ready && !failed; e++)
+        {
+            size_t index = events[e].data.u64 / 2;
+            bool output_side = events[e].data.u64 % 2;
+            StageSegment &segment = segments[index];
+
+            // skip an event for a side that stopped being watched earlier in this round
+            if (output_side ? !segment.writing : !segment.reading)
+            {
+                continue;
+            }
+
+            if (!output_side)
+            {
+                ssize_t read_byte = segment.reader->read_some();
+
+                if (read_byte == 0)
+                {
+                    // the stream ended without an end frame
+                    errno = EPIPE;
+                }
+                if (read_byte == 0 || (read_byte == -1 && errno != EAGAIN))
+                {
+                    report_io_error();
+                    failed = true;
+                    break;
+                }
+            }
+
+            // run what arrived, and pass on what came out, for as long as the pipe takes it
+            bool progress = true;
+            while (progress && !failed)
+            {
+                feed_segment(segment);
+
+                size_t waiting = segment.chain->output.size() - segment.sent;
+                if (segment.out_fd != -1 && !flush_segment(segment))
+                {
+                    report_io_error();
+                    failed = true;
+                }
+
+                progress = segment.chain->output.size() - segment.sent < waiting && !segment.input_done &&
+                           segment.reader->has_buffered_frame();
+            }
+
+            watch_segment(epoll_fd, segment, index);
+
+            // a segment is done once its input ended and its output is written; closing its pipe ends the next input
+            if (segment.input_done && !segment.writing && !segment.reading)
+            {
+                if (segment.out_fd != -1)
+                {
+                    close(segment.out_fd);
+                    segment.out_fd = -1;
+                }
+                running--;
+            }
+        }
+    }
+
+    // stop the stages of this process; the walker and the forked stages notice the closed pipes
+    for (StageSegment &segment : segments)
+    {
+        if (segment.in_fd != -1)
+        {
+            close(segment.in_fd);
+        }
+        if (segment.out_fd != -1)
+        {
+            close(segment.out_fd);
+        }
+    }
+    if (epoll_fd != -1)
+    {
+        close(epoll_fd);
+    }
+
+    producer.join();
+
+    for (StageSegment &segment : segments)
+    {
+        if (segment.pid > 0)
+        {
+            waitpid(segment.pid, nullptr, 0);
+        }
+    }
+
+    size_t processes = 1;
+    for (const StageSegment &segment : segments)
+    {
+        processes += segment.forked;
+    }
+
+    printf("\nWRITE: %zu bytes in %zu frames into %zu stages (%zu processes)\n", write_byte, write_frames,
+           options.stages.size(), processes);
+    printf("DISPLAYED: %zu records\n", printer->printed);
+
+    chrono::duration<double, milli> execution_time = chrono::steady_clock::now() - time_start;
+    printf("\nEstimated Data Transmission Time: %.3f milliseconds (ms)\n\n", execution_time.count());
+#else
+    fprintf(stderr, "\n--pipeline needs epoll (Linux)\n");
+#endif
+}
+
+/*
+    TrigramIndex class keeps the listing of a directory tree on disk, to answer repeated searches without walking the tree
+
+    a trigram is a sequence of 3 bytes; a path holds a literal of 3 bytes or more only if it holds every trigram of it
+    so for every trigram in any path, the index keeps the sorted ids of the paths holding it (its postings),
+    and a literal is searched by intersecting the postings of its trigrams, then checking the few paths left
+
+    the file is laid out to be used straight from mmap, with no parsing:
+    - a header, with the offset of every section below
+    - the root directory, and every path as a record, as in the listing, with the offset of each record
+    - for every path, the directory it is in; for every directory, its path and its modification time
+    - the trigrams, sorted, each with its number of postings and where they start; then all postings
+
+    the index is kept up to date by comparing the modification time of every directory, which changes whenever
+    an entry is added to, removed from or renamed in it: only the directories that changed are listed again
+*/
+class TrigramIndex
+{
+private:
+    struct Header
+    {
+        char magic[8];
+        uint64_t path_count;
+        uint64_t directory_count;
+        uint64_t trigram_count;
+        uint64_t root_offset;
+        uint64_t root_size;
+        uint64_t listing_offset;
+        uint64_t listing_size;
+        uint64_t path_offsets_offset;
+        uint64_t path_parents_offset;
+        uint64_t directories_offset;
+        uint64_t trigrams_offset;
+        uint64_t postings_offset;
+    };
+
+    struct DirectoryEntry
+    {
+        // the path of the directory, or NO_PATH for the root
+        uint32_t path_id;
+        uint32_t reserved;
+        int64_t modified_seconds;
+        int64_t modified_nanoseconds;
+    };
+
+    struct TrigramEntry
+    {
+        uint32_t trigram;
+        uint32_t count;
+        uint64_t offset;
+    };
+
+    static const uint32_t NO_PATH = UINT32_MAX;
+
+    char *mapping = nullptr;
+    size_t mapping_size = 0;
+
+    const Header *header = nullptr;
+    const char *listing = nullptr;
+    const uint64_t *path_offsets = nullptr;
+    const uint32_t *path_parents = nullptr;
+    const DirectoryEntry *directories = nullptr;
+    const TrigramEntry *trigrams = nullptr;
+    const uint32_t *postings = nullptr;
+
+    // a tree being collected, to write an index of
+    struct Tree
+    {
+        vector<string> paths;
+        vector<unsigned char> types;
+        map<string, struct stat> directories;
+    };
+
+    static void modification_time(const struct stat &status, int64_t &seconds, int64_t &nanoseconds)
+    {
+#ifdef __APPLE__
+        seconds = status.st_mtimespec.tv_sec;
+        nanoseconds = status.st_mtimespec.tv_nsec;
+#else
+        seconds = status.st_mtim.tv_sec;
+        nanoseconds = status.st_mtim.tv_nsec;
+#endif
+    }
+
+    static uint32_t trigram_at(const char *bytes)
+    {
+        return uint32_t(static_cast<unsigned char>(bytes[0])) << 16 |
+               uint32_t(static_cast<unsigned char>(bytes[1])) << 8 |
+               uint32_t(static_cast<unsigned char>(bytes[2]));
+    }
+
+    // the trigrams of a string, sorted and unique
+    static void trigrams_of(const char *text, size_t length, vector<uint32_t> &result)
+    {
+        result.clear();
+        for (size_t i = 0; i + 3 <= length; i++)
+        {
+            result.push_back(trigram_at(text + i));
+        }
+        sort(result.begin(), result.end());
+        result.erase(unique(result.begin(), result.end()), result.end());
+    }
+
+    // list a directory (and, with "recursive", everything under it) into "tree", from scratch
+    static void list_into(int root_fd, const string &relative_path, bool recursive, Tree &tree, vector<string> *sub_directories)
+    {
+        int directory_fd = relative_path.empty()
+                               ? dup(root_fd)
+                               : openat(root_fd, relative_path.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (directory_fd == -1)
+        {
+            return;
+        }
+
+        struct stat status;
+        if (fstat(directory_fd, &status) == 0)
+        {
+            tree.directories[relative_path] = status;
+        }
+
+        string prefix = relative_path.empty() ? "" : relative_path + "/";
+        vector<string> found_directories;
+
+        read_directory_entries(directory_fd, [&](const char *name, size_t length, unsigned char type, uint64_t)
+                               {
+            // hidden entries are not listed, as "ls" does
+            if (name[0] == '.')
+            {
+                return;
+            }
+            if (prefix.size() + length > MAX_RECORD_NAME)
+            {
+                report_long_path(prefix, length);
+                return;
+            }
+
+            if (type == DT_UNKNOWN)
+            {
+                struct stat entry_status;
+                if (fstatat(directory_fd, name, &entry_status, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(entry_status.st_mode))
+                {
+                    type = DT_DIR;
+                }
+            }
+
+            tree.paths.push_back(prefix + string(name, length));
+            tree.types.push_back(type);
+            if (type == DT_DIR)
+            {
+                found_directories.push_back(tree.paths.back());
+            } });
+
+        close(directory_fd);
+
+        for (const string &directory : found_directories)
+        {
+            if (recursive)
+            {
+                list_into(root_fd, directory, true, tree, nullptr);
+            }
+            else if (sub_directories)
+            {
+                sub_directories->push_back(directory);
+            }
+        }
+    }
+
+    // the record of path "id" of the mapped index
+    Record record(uint32_t id) const
+    {
+        Record result;
+        read_record(listing + path_offsets[id], listing + path_offsets[id + 1], result);
+        return result;
+    }
+
+    string path(uint32_t id) const
+    {
+        Record found = record(id);
+        return string(found.name, found.length);
+    }
+
+    // whether no directory of the mapped index has changed since it was written
+    bool up_to_date(int root_fd) const
+    {
+        for (uint32_t directory = 0; directory < header->directory_count; directory++)
+        {
+            const DirectoryEntry &entry = directories[directory];
+            string relative_path = entry.path_id == NO_PATH ? "." : path(entry.path_id);
+
+            struct stat status;
+            if (fstatat(root_fd, relative_path.c_str(), &status, AT_SYMLINK_NOFOLLOW) == -1)
+            {
+                return false;
+            }
+
+            int64_t seconds, nanoseconds;
+            modification_time(status, seconds, nanoseconds);
+            if (seconds != entry.modified_seconds || nanoseconds != entry.modified_nanoseconds)
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // bring the sub-tree of mapped directory "directory" up to date into "tree"; return the number of directories listed again
+    size_t refresh_directory(int root_fd, uint32_t directory, const vector<vector<uint32_t>> &children,
+                             const vector<int64_t> &directory_of_path, const map<string, uint32_t> &old_directories, Tree &tree) const
+    {
+        const DirectoryEntry &entry = directories[directory];
+        string relative_path = entry.path_id == NO_PATH ? "" : path(entry.path_id);
+
+        struct stat status;
+        if (fstatat(root_fd, relative_path.empty() ? "." : relative_path.c_str(), &status, AT_SYMLINK_NOFOLLOW) == -1 ||
+            !S_ISDIR(status.st_mode))
+        {
+            // the directory is gone, and so is everything under it
+            return 0;
+        }
+
+        int64_t seconds, nanoseconds;
+        modification_time(status, seconds, nanoseconds);
+
+        // unchanged: keep the entries from the index, and check the sub-directories
+        if (seconds == entry.modified_seconds && nanoseconds == entry.modified_nanoseconds)
+        {
+            tree.directories[relative_path] = status;
+
+            size_t listed = 0;
+            for (uint32_t child : children[directory])
+            {
+                tree.paths.push_back(path(child));
+                tree.types.push_back(record(child).type);
+                if (directory_of_path[child] != -1)
+                {
+                    listed += refresh_directory(root_fd, directory_of_path[child], children, directory_of_path, old_directories, tree);
+                }
+            }
+            return listed;
+        }
+
+        // changed: list it again; a sub-directory known to the index is checked in turn, a new one is listed whole
+        vector<string> sub_directories;
+        list_into(root_fd, relative_path, false, tree, &sub_directories);
+
+        size_t listed = 1;
+        for (const string &sub_directory : sub_directories)
+        {
+            map<string, uint32_t>::const_iterator known = old_directories.find(sub_directory);
+            if (known != old_directories.end())
+            {
+                listed += refresh_directory(root_fd, known->second, children, directory_of_path, old_directories, tree);
+            }
+            else
+            {
+                list_into(root_fd, sub_directory, true, tree, nullptr);
+                listed++;
+            }
+        }
+        return listed;
+    }
+
+    // write an index of "tree" to "file", replacing it at once; return false on error
+    static bool write_index(const string &file, const string &root, Tree &tree)
+    {
+        Header header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, "IPCTRI2", 8);
+
+        // the listing, with the offset of every record (and one past the last)
+        string listing;
+        vector<uint64_t> path_offsets;
+        for (size_t id = 0; id < tree.paths.size(); id++)
+        {
+            Record entry;
+            entry.name = tree.paths[id].data();
+            entry.length = tree.paths[id].size();
+            entry.type = tree.types[id];
+            entry.flags = 0;
+
+            path_offsets.push_back(listing.size());
+            append_record(listing, entry, "", 0);
+        }
+        path_offsets.push_back(listing.size());
+
+        // the directories, in order of their path, and the directory every path is in
+        map<string, uint32_t> directory_ids;
+        for (map<string, struct stat>::iterator it = tree.directories.begin(); it != tree.directories.end(); ++it)
+        {
+            uint32_t id = directory_ids.size();
+            directory_ids[it->first] = id;
+        }
+
+        vector<DirectoryEntry> directories(tree.directories.size());
+        vector<uint32_t> path_parents(tree.paths.size(), 0);
+
+        {
+            map<string, struct stat>::iterator it = tree.directories.begin();
+            for (size_t i = 0; i < directories.size(); i++, ++it)
+            {
+                directories[i].path_id = NO_PATH;
+                directories[i].reserved = 0;
+                modification_time(it->second, directories[i].modified_seconds, directories[i].modified_nanoseconds);
+            }
+        }
+
+        for (uint32_t id = 0; id < tree.paths.size(); id++)
+        {
+            const string &path = tree.paths[id];
+            size_t slash = path.rfind('/');
+            map<string, uint32_t>::iterator parent = directory_ids.find(slash == string::npos ? "" : path.substr(0, slash));
+            if (parent != directory_ids.end())
+            {
+                path_parents[id] = parent->second;
+            }
+
+            map<string, uint32_t>::iterator self = directory_ids.find(path);
+            if (self != directory_ids.end())
+            {
+                directories[self->second].path_id = id;
+            }
+        }
+
+        // the postings: a (trigram, path id) pair for every trigram of every path, sorted, then cut into one list per trigram
+        // (only the trigrams that occur take memory, and every list comes out in order of path id)
+        vector<uint64_t> pairs;
+        vector<uint32_t> path_trigrams;
+        for (uint32_t id = 0; id < tree.paths.size(); id++)
+        {
+            trigrams_of(tree.paths[id].data(), tree.paths[id].size(), path_trigrams);
+            for (uint32_t trigram : path_trigrams)
+            {
+                pairs.push_back(uint64_t(trigram) << 32 | id);
+            }
+        }
+        sort(pairs.begin(), pairs.end());
+
+        vector<TrigramEntry> trigrams;
+        vector<uint32_t> postings(pairs.size());
+        for (size_t i = 0; i < pairs.size(); i++)
+        {
+            uint32_t trigram = pairs[i] >> 32;
+            if (trigrams.empty() || trigrams.back().trigram != trigram)
+            {
+                TrigramEntry entry = {trigram, 0, i};
+                trigrams.push_back(entry);
+            }
+            trigrams.back().count++;
+            postings[i] = uint32_t(pairs[i]);
+        }
+        vector<uint64_t>().swap(pairs);
+
+        // lay the sections out, each aligned to 8 bytes
+        uint64_t offset = sizeof(header);
+        auto place = [&offset](uint64_t size)
+        {
+            uint64_t start = offset;
+            offset = (offset + size + 7) & ~uint64_t(7);
+            return start;
+        };
+
+        header.path_count = tree.paths.size();
+        header.directory_count = directories.size();
+        header.trigram_count = trigrams.size();
+        header.root_size = root.size();
+        header.root_offset = place(root.size());
+        header.listing_size = listing.size();
+        header.listing_offset = place(listing.size());
+        header.path_offsets_offset = place(path_offsets.size() * sizeof(uint64_t));
+        header.path_parents_offset = place(path_parents.size() * sizeof(uint32_t));
+        header.directories_offset = place(directories.size() * sizeof(DirectoryEntry));
+        header.trigrams_offset = place(trigrams.size() * sizeof(TrigramEntry));
+        header.postings_offset = place(postings.size() * sizeof(uint32_t));
+
+        string temporary = file + ".tmp";
+        int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd == -1)
+        {
+            return false;
+        }
+
+        const char padding[8] = {0};
+        uint64_t written = 0;
+        bool success = true;
+        auto section = [&](uint64_t at, const void *data, size_t size)
+        {
+            success = success && write_all(fd, padding, at - written) && write_all(fd, data, size);
+            written = at + size;
+        };
+
+        section(0, &header, sizeof(header));
+        section(header.root_offset, root.data(), root.size());
+        section(header.listing_offset, listing.data(), listing.size());
+        section(header.path_offsets_offset, path_offsets.data(), path_offsets.size() * sizeof(uint64_t));
+        section(header.path_parents_offset, path_parents.data(), path_parents.size() * sizeof(uint32_t));
+        section(header.directories_offset, directories.data(), directories.size() * sizeof(DirectoryEntry));
+        section(header.trigrams_offset, trigrams.data(), trigrams.size() * sizeof(TrigramEntry));
+        section(header.postings_offset, postings.data(), postings.size() * sizeof(uint32_t));
+
+        success = close(fd) == 0 && success;
+
+        return success && rename(temporary.c_str(), file.c_str()) == 0;
+    }
+
+    // map an index file; return false if it is missing, damaged or of another root
+    bool map_file(const string &file, const string &root)
+    {
+        unmap();
+
+        int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+        {
+            return false;
+        }
+
+        struct stat status;
+        if (fstat(fd, &status) == -1 || size_t(status.st_size) < sizeof(Header))
+        {
+            close(fd);
+            return false;
+        }
+
+        void *memory = mmap(nullptr, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (memory == MAP_FAILED)
+        {
+            return false;
+        }
+
+        mapping = static_cast<char *>(memory);
+        mapping_size = status.st_size;
+        header = reinterpret_cast<const Header *>(mapping);
+
+        if (!valid(root))
+        {
+            unmap();
+            return false;
+        }
+
+        return true;
+    }
+
+    // whether "count" elements of "size" bytes from "offset" (aligned as the writer does) lie inside the mapping
+    bool section_fits(uint64_t offset, uint64_t count, size_t size) const
+    {
+        return offset % 8 == 0 && offset <= mapping_size && count <= (mapping_size - offset) / size;
+    }
+
+    /*
+        check everything of the mapped file that is used, so a damaged (or truncated) index is rebuilt, never read out of bounds
+        - every section lies inside the file
+        - the path offsets rise, and each delimits one whole record of the listing
+        - the parent of every path, the path of every directory, and every posting name an existing entry
+        - the trigrams are sorted, and their postings follow each other to the end of the postings
+        point the sections into the mapping as it goes
+    */
+    bool valid(const string &root)
+    {
+        if (memcmp(header->magic, "IPCTRI2", 8) != 0 || header->path_count >= NO_PATH ||
+            header->directory_count == 0 || header->directory_count > UINT32_MAX || header->trigram_count > UINT32_MAX)
+        {
+            return false;
+        }
+
+        if (!section_fits(header->root_offset, header->root_size, 1) || header->root_size != root.size() ||
+            memcmp(mapping + header->root_offset, root.data(), root.size()) != 0 ||
+            !section_fits(header->listing_offset, header->listing_size, 1) ||
+            !section_fits(header->path_offsets_offset, header->path_count + 1, sizeof(uint64_t)) ||
+            !section_fits(header->path_parents_offset, header->path_count, sizeof(uint32_t)) ||
+            !section_fits(header->directories_offset, header->directory_count, sizeof(DirectoryEntry)) ||
+            !section_fits(header->trigrams_offset, header->trigram_count, sizeof(TrigramEntry)) ||
+            header->postings_offset % 8 != 0 || header->postings_offset > mapping_size)
+        {
+            return false;
+        }
+
+        listing = mapping + header->listing_offset;
+        path_offsets = reinterpret_cast<const uint64_t *>(mapping + header->path_offsets_offset);
+        path_parents = reinterpret_cast<const uint32_t *>(mapping + header->path_parents_offset);
+        directories = reinterpret_cast<const DirectoryEntry *>(mapping + header->directories_offset);
+        trigrams = reinterpret_cast<const TrigramEntry *>(mapping + header->trigrams_offset);
+        postings = reinterpret_cast<const uint32_t *>(mapping + header->postings_offset);
+
+        if (path_offsets[0] != 0 || path_offsets[header->path_count] != header->listing_size)
+        {
+            return false;
+        }
+        for (uint64_t id = 0; id < header->path_count; id++)
+        {
+            Record entry;
+            if (path_offsets[id] >= path_offsets[id + 1] || path_offsets[id + 1] > header->listing_size ||
+                read_record(listing + path_offsets[id], listing + path_offsets[id + 1], entry) != listing + path_offsets[id + 1] ||
+                path_parents[id] >= header->directory_count)
+            {
+                return false;
+            }
+        }
+
+        for (uint64_t directory = 0; directory < header->directory_count; directory++)
+        {
+            if (directories[directory].path_id != NO_PATH && directories[directory].path_id >= header->path_count)
+            {
+                return false;
+            }
+        }
+
+        // the postings are the lists of the trigrams, one after another, with nothing past the last
+        uint64_t posting_count = 0;
+        for (uint64_t i = 0; i < header->trigram_count; i++)
+        {
+            if ((i > 0 && trigrams[i].trigram <= trigrams[i - 1].trigram) || trigrams[i].offset != posting_count)
+            {
+                return false;
+            }
+            posting_count += trigrams[i].count;
+        }
+        if (!section_fits(header->postings_offset, posting_count, sizeof(uint32_t)))
+        {
+            return false;
+        }
+        for (uint64_t i = 0; i < posting_count; i++)
+        {
+            if (postings[i] >= header->path_count)
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    void unmap()
+    {
+        if (mapping)
+        {
+            munmap(mapping, mapping_size);
+        }
+        mapping = nullptr;
+        header = nullptr;
+    }
+
+public:
+    ~TrigramIndex()
+    {
+        unmap();
+    }
+
+    /*
+        open the index of "root" kept in "file", building it, or bringing it up to date, as needed
+        return the number of directories listed (0 when the index was up to date), or -1 on error
+    */
+    long open(const string &file, const string &root)
+    {
+        Tree tree;
+        long listed;
+
+        if (map_file(file, root))
+        {
+            int root_fd = ::open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (root_fd == -1)
+            {
+                fprintf(stderr, "Failed to open the directory \"%s\": %s\n", root.c_str(), strerror(errno));
+                return -1;
+            }
+
+            // the common case, checked with a single fstatat per directory
+            if (up_to_date(root_fd))
+            {
+                close(root_fd);
+                return 0;
+            }
+
+            // the entries of every directory, and the directory of every path
+            vector<vector<uint32_t>> children(header->directory_count);
+            vector<int64_t> directory_of_path(header->path_count, -1);
+            map<string, uint32_t> old_directories;
+            uint32_t root_directory = 0;
+
+            for (uint32_t id = 0; id < header->path_count; id++)
+            {
+                children[path_parents[id]].push_back(id);
+            }
+            for (uint32_t directory = 0; directory < header->directory_count; directory++)
+            {
+                if (directories[directory].path_id == NO_PATH)
+                {
+                    root_directory = directory;
+                    continue;
+                }
+                directory_of_path[directories[directory].path_id] = directory;
+                old_directories[path(directories[directory].path_id)] = directory;
+            }
+
+            listed = refresh_directory(root_fd, root_directory, children, directory_of_path, old_directories, tree);
+            close(root_fd);
+
+            if (listed == 0)
+            {
+                return 0;
+            }
+        }
+        else
+        {
+            // no index yet: walk the whole tree, in parallel
+            DirectoryWalker walker(walker_thread_count(), BUFFER_SIZE);
+
+            walker.on_directory([&tree](const string &relative_path, const struct stat &status)
+                                { tree.directories[relative_path] = status; });
+
+            bool success = walker.walk(root, [&tree](const char *batch, size_t length)
+                                       {
+                const char *end = batch + length;
+                Record entry;
+                for (const char *position = batch; (position = read_record(position, end, entry)) != nullptr;)
+                {
+                    tree.paths.push_back(string(entry.name, entry.length));
+                    tree.types.push_back(entry.type);
+                }
+                return true; });
+
+            if (!success)
+            {
+                return -1;
+            }
+
+            listed = tree.directories.size();
+        }
+
+        if (!write_index(file, root, tree) || !map_file(file, root))
+        {
+            fprintf(stderr, "Failed to write the index \"%s\": %s\n", file.c_str(), strerror(errno));
+            return -1;
+        }
+
+        return listed;
+    }
+
+    size_t path_count() const
+    {
+        return header->path_count;
+    }
+
+    size_t trigram_count() const
+    {
+        return header->trigram_count;
+    }
+
+    // the whole listing, as the records the producer would send
+    const char *listing_data() const
+    {
+        return listing;
+    }
+
+    size_t listing_size() const
+    {
+        return header->listing_size;
+    }
+
+    // call "found(file, length)" for every path holding "literal", in order of the listing
+    template <typename Found>
+    void find_literal(const string &literal, Found found) const
+    {
+        const char *needle = literal.data();
+        size_t needle_length = literal.size();
+
+        // too short for a trigram: check every path
+        if (needle_length < 3)
+        {
+            for (uint32_t id = 0; id < header->path_count; id++)
+            {
+                Record file = record(id);
+                if (find_substring(file.name, file.name + file.length, needle, needle_length))
+                {
+                    found(file.name, file.length);
+                }
+            }
+            return;
+        }
+
+        // the postings of every trigram of the literal, shortest first
+        vector<uint32_t> needle_trigrams;
+        trigrams_of(needle, needle_length, needle_trigrams);
+
+        vector<const TrigramEntry *> entries;
+        const TrigramEntry *table_end = trigrams + header->trigram_count;
+        for (uint32_t trigram : needle_trigrams)
+        {
+            const TrigramEntry *entry = lower_bound(trigrams, table_end, trigram, [](const TrigramEntry &a, uint32_t b)
+                                                    { return a.trigram < b; });
+            if (entry == table_end || entry->trigram != trigram)
+            {
+                // no path holds this trigram, so none holds the literal
+                return;
+            }
+            entries.push_back(entry);
+        }
+        sort(entries.begin(), entries.end(), [](const TrigramEntry *a, const TrigramEntry *b)
+             { return a->count < b->count; });
+
+        // intersect, looking each candidate up in the longer postings by binary search
+        vector<uint32_t> candidates(postings + entries[0]->offset, postings + entries[0]->offset + entries[0]->count);
+        for (size_t i = 1; i < entries.size() && !candidates.empty(); i++)
+        {
+            const uint32_t *list = postings + entries[i]->offset;
+            const uint32_t *list_end = list + entries[i]->count;
+            size_t kept = 0;
+
+            for (uint32_t candidate : candidates)
+            {
+                list = lower_bound(list, list_end, candidate);
+                if (list == list_end)
+                {
+                    break;
+                }
+                if (*list == candidate)
+                {
+                    candidates[kept++] = candidate;
+                }
+            }
+            candidates.resize(kept);
+        }
+
+        // every trigram in a path does not make the literal: check the candidates
+        for (uint32_t id : candidates)
+        {
+            Record file = record(id);
+            if (find_substring(file.name, file.name + file.length, needle, needle_length))
+            {
+                found(file.name, file.length);
+            }
+        }
+    }
+};
+
+// answer the search of "child_process" from the index of "~/[path]" kept in "index_file"
+void index_search(string parent_process, CustomGrep child_process, PipelineOptions options)
+{
+    auto time_begin = chrono::steady_clock::now();
+
+    TrigramIndex index;
+    long listed = index.open(options.index_file, parent_process);
+    if (listed == -1)
+    {
+        return;
+    }
+
+    auto time_open = chrono::steady_clock::now();
+
+    // literals are looked up in the postings; globs, and literals mixed with them, scan the indexed listing instead
+    bool literals_only = true;
+    for (uint32_t id = 0; id < child_process.pattern_count(); id++)
+    {
+        literals_only = literals_only && !PatternMatcher::is_glob(child_process.pattern(id));
+    }
+
+    if (literals_only)
+    {
+        for (uint32_t id = 0; id < child_process.pattern_count(); id++)
+        {
+            index.find_literal(child_process.pattern(id), [id](const char *file, size_t length)
+                               { CustomGrep::display(file, length, id); });
+        }
+    }
+    else
+    {
+        child_process.grep_batch(index.listing_data(), index.listing_size());
+    }
+
+    auto time_end = chrono::steady_clock::now();
+
+    printf("\nINDEX: %zu paths, %zu trigrams, %ld directories listed\n", index.path_count(), index.trigram_count(), listed);
+
+    // display the estimated times
+    cout << "\nEstimated Index Update Time: " << chrono::duration_cast<chrono::milliseconds>(time_open - time_begin).count() << " milliseconds (ms)" << endl;
+    cout << "Estimated Query Time: " << chrono::duration_cast<chrono::microseconds>(time_end - time_open).count() << " microseconds (us)\n"
+         << endl;
+
+    child_process.report();
+}
+
+/*
+    Daemon mode: a server with a warm listing, answering queries over a Unix domain socket
+
+    --serve=SOCKET lists the directory once, into memory shared with a pool of pre-forked worker processes,
+    so a query costs the matching only: no fork, no walk of the directory
+    - every worker waits on the listening socket (with EPOLLEXCLUSIVE, a connection wakes a single worker),
+      and serves many clients at once from an epoll loop over non-blocking sockets,
+      matching a query a slice of the listing at a time, so the clients of a worker take turns
+    - SIGHUP lists the directory again: new workers start on the new listing, the old ones finish their clients and exit
+    - SIGINT or SIGTERM stops the server
+
+    the protocol is made of frames, as in the pipeline; a client sends a zero-length frame when it is done
+    - a query: QUERY_REQUEST, followed by the names seeking for, each ended by '\0'
+    - its answer: RESULT_HITS frames of hits "[pattern id][length][file]" (as from a fan-out consumer),
+      then a RESULT_STATS frame with the timings of the query, or a RESULT_ERROR frame with a message;
+      then a zero-length frame
+    a client may send several queries over one connection; they are answered in order
+    a request is at most MAX_QUERY_SIZE bytes: a client sending a larger frame is disconnected
+*/
+const char QUERY_REQUEST = 'Q';
+const char RESULT_HITS = 'H';
+const char RESULT_STATS = 'S';
+const char RESULT_ERROR = 'E';
+
+// the largest request a worker reads from a client
+const size_t MAX_QUERY_SIZE = BUFFER_SIZE;
+
+// the payload of a RESULT_STATS frame, after its first byte
+struct QueryStats
+{
+    uint64_t matches;
+
+    // the records searched: the whole listing
+    uint64_t records;
+
+    // the time spent matching, and from reading the query to queueing its last result
+    uint64_t match_ns;
+    uint64_t server_ns;
+
+    uint32_t worker_pid;
+
+    // the listing answering: 0 at the start of the server, one more at every reload
+    uint32_t generation;
+};
+
+// a listing in memory shared with the workers
+struct SharedListing
+{
+    char *data = nullptr;
+    size_t length = 0;
+    size_t mapping_size = 0;
+    size_t records = 0;
+    uint32_t generation = 0;
+};
+
+// list "directory" into a new shared mapping; return false if the directory cannot be listed
+bool load_listing(const string &directory, const PipelineOptions &options, SharedListing &listing, uint32_t generation)
+{
+    string files;
+
+    if (!walk_listing(directory, options, [&files](const char *batch, size_t length)
+                      { files.append(batch, length);
+                        return true; }))
+    {
+        return false;
+    }
+
+    // the workers are forked after the listing is in place, so an anonymous shared mapping is enough
+    listing.mapping_size = max(files.size(), size_t(1));
+    void *mapping = mmap(nullptr, listing.mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED)
+    {
+        fprintf(stderr, "\nShared Memory Creation Failed: %s\n", strerror(errno));
+        return false;
+    }
+
+    listing.data = static_cast<char *>(mapping);
+    listing.length = files.size();
+    memcpy(listing.data, files.data(), files.size());
+    mprotect(mapping, listing.mapping_size, PROT_READ);
+
+    listing.records = 0;
+    Record record;
+    const char *end = listing.data + listing.length;
+    for (const char *position = listing.data; (position = read_record(position, end, record)) != nullptr;)
+    {
+        listing.records++;
+    }
+
+    listing.generation = generation;
+
+    return true;
+}
+
+/*
+    a query being answered: the listing is matched a slice at a time, each slice a whole number of records,
+    so a query over a large listing does not hold up the other clients of the worker, nor pile up its answer
+*/
+struct ServeQuery
+{
+    // the names of the query, with a matcher of its own (the one of CustomGrep belongs to the program)
+    PatternMatcher patterns;
+
+    // the first record not matched yet
+    const char *position = nullptr;
+
+    uint64_t matches = 0;
+    uint64_t match_ns = 0;
+    chrono::steady_clock::time_point time_begin;
+};
+
+// the bytes of the listing matched at a time for a query
+const size_t QUERY_SLICE = BUFFER_SIZE;
+
+/*
+    start the query in "request": return a query to go on with, or nullptr when the request is answered already
+    (with a RESULT_ERROR frame appended to "output")
+*/
+ServeQuery *start_query(const SharedListing &listing, const char *request, size_t length, string &output)
+{
+    auto time_begin = chrono::steady_clock::now();
+
+    // the names, each ended by '\0'
+    vector<string> names;
+    if (length > 0 && request[0] == QUERY_REQUEST)
+    {
+        const char *end = request + length;
+        for (const char *name = request + 1; name < end;)
+        {
+            const char *name_end = static_cast<const char *>(memchr(name, '\0', end - name));
+            if (!name_end)
+            {
+                name_end = end;
+            }
+            if (name_end > name)
+            {
+                names.push_back(string(name, name_end));
+            }
+            name = name_end + 1;
+        }
+    }
+
+    if (names.empty())
+    {
+        string error(1, RESULT_ERROR);
+        error += length > 0 && request[0] == QUERY_REQUEST ? "no name to seek for" : "unknown request";
+        append_frame(output, error.data(), error.size());
+        append_frame(output, nullptr, 0);
+        return nullptr;
+    }
+
+    ServeQuery *query = new ServeQuery();
+    for (const string &name : names)
+    {
+        query->patterns.add(name);
+    }
+    query->patterns.compile();
+    query->position = listing.data;
+    query->time_begin = time_begin;
+
+    return query;
+}
+
+/*
+    match the next slice of the listing for "query", appending the frames of its hits to "output"
+    return true once the query is answered: its RESULT_STATS frame and its end frame are appended
+*/
+bool continue_query(const SharedListing &listing, ServeQuery &query, string &output)
+{
+    // the slice ends on the first record boundary past QUERY_SLICE bytes, or at the end of the listing
+    const char *end = listing.data + listing.length;
+    const char *slice_end = query.position;
+    Record record;
+    while (size_t(slice_end - query.position) < QUERY_SLICE)
+    {
+        const char *next = read_record(slice_end, end, record);
+        if (!next)
+        {
+            slice_end = end;
+            break;
+        }
+        slice_end = next;
+    }
+
+    string hits(1, RESULT_HITS);
+
+    auto time_match = chrono::steady_clock::now();
+    CustomGrep::match_batch(query.patterns, query.position, slice_end - query.position, [&](const char *file, size_t file_length, uint32_t id)
+                            {
+        uint32_t hit[2] = {id, static_cast<uint32_t>(file_length)};
+        hits.append(reinterpret_cast<const char *>(hit), sizeof(hit));
+        hits.append(file, file_length);
+        query.matches++;
+
+        if (hits.size() >= size_t(BUFFER_SIZE))
+        {
+            append_frame(output, hits.data(), hits.size());
+            hits.resize(1);
+        } });
+    query.match_ns += chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - time_match).count();
+
+    if (hits.size() > 1)
+    {
+        append_frame(output, hits.data(), hits.size());
+    }
+
+    query.position = slice_end;
+    if (query.position < end)
+    {
+        return false;
+    }
+
+    QueryStats stats;
+    stats.matches = query.matches;
+    stats.records = listing.records;
+    stats.match_ns = query.match_ns;
+    stats.worker_pid = getpid();
+    stats.generation = listing.generation;
+    stats.server_ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - query.time_begin).count();
+
+    string frame(1, RESULT_STATS);
+    frame.append(reinterpret_cast<const char *>(&stats), sizeof(stats));
+    append_frame(output, frame.data(), frame.size());
+    append_frame(output, nullptr, 0);
+
+    return true;
+}
+
+#ifdef __linux__
+// set by the signal handlers of a worker
+volatile sig_atomic_t worker_stopping = 0;
+
+void stop_worker(int)
+{
+    worker_stopping = 1;
+}
+
+// a client of a worker
+struct ServeClient
+{
+    int fd;
+    FrameReader reader;
+
+    // the query being answered, if any: the next request is read once it is done
+    unique_ptr<ServeQuery> query;
+
+    // the answers not yet written, and how much of them is
+    string output;
+    size_t sent = 0;
+
+    // set once the client sent its end frame (or a request it cannot be answered on): the requests after it are not read
+    bool closing = false;
+
+    // set once the client closed its side: the requests read before are still answered, then the client is let go
+    bool input_ended = false;
+
+    ServeClient(int fd) : fd(fd), reader(fd, 2 * BUFFER_SIZE, MAX_QUERY_SIZE) {}
+};
+
+/*
+    make way for the socket of the server at "address": a socket file left by a server that is gone would fail the bind
+    only a socket with nothing listening on it is removed; return false (with a message) if the path is taken
+*/
+bool remove_stale_socket(const struct sockaddr_un &address)
+{
+    struct stat status;
+    if (lstat(address.sun_path, &status) == -1)
+    {
+        if (errno == ENOENT)
+        {
+            return true;
+        }
+        fprintf(stderr, "\nSocket Creation Failed: %s: %s\n", address.sun_path, strerror(errno));
+        return false;
+    }
+
+    if (!S_ISSOCK(status.st_mode))
+    {
+        fprintf(stderr, "\nSocket Creation Failed: %s exists, and is not a socket\n", address.sun_path);
+        return false;
+    }
+
+    // a connection refused means no server is left behind the socket
+    int probe_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (probe_fd == -1)
+    {
+        fprintf(stderr, "\nSocket Creation Failed: %s\n", strerror(errno));
+        return false;
+    }
+    int connected = connect(probe_fd, reinterpret_cast<const struct sockaddr *>(&address), sizeof(address));
+    int connect_error = errno;
+    close(probe_fd);
+
+    if (connected == 0)
+    {
+        fprintf(stderr, "\nSocket Creation Failed: a server is already listening on %s\n", address.sun_path);
+        return false;
+    }
+    if (connect_error != ECONNREFUSED)
+    {
+        fprintf(stderr, "\nSocket Creation Failed: %s: %s\n", address.sun_path, strerror(connect_error));
+        return false;
+    }
+
+    if (unlink(address.sun_path) == -1 && errno != ENOENT)
+    {
+        fprintf(stderr, "\nSocket Creation Failed: %s: %s\n", address.sun_path, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+// the loop of a worker: accept clients, and answer their queries, until told to stop
+void serve_worker(int listen_fd, const SharedListing &listing, const sigset_t &old_mask)
+{
+    struct sigaction action = {};
+    action.sa_handler = stop_worker;
+    sigaction(SIGTERM, &action, nullptr);
+    sigaction(SIGINT, &action, nullptr);
+    signal(SIGHUP, SIG_IGN);
+    signal(SIGCHLD, SIG_DFL);
+    sigprocmask(SIG_SETMASK, &old_mask, nullptr);
+
+    // stop as well if the server dies without stopping the workers
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    if (getppid() == 1)
+    {
+        worker_stopping = 1;
+    }
+
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1)
+    {
+        _exit(1);
+    }
+
+    struct epoll_event listen_event = {};
+    listen_event.events = EPOLLIN;
+#ifdef EPOLLEXCLUSIVE
+    listen_event.events |= EPOLLEXCLUSIVE;
+#endif
+    listen_event.data.fd = listen_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &listen_event);
+
+    map<int, unique_ptr<ServeClient>> clients;
+    bool accepting = true;
+
+    auto drop = [&](int fd)
+    {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+        clients.erase(fd);
+    };
+
+    while (accepting || !clients.empty())
+    {
+        // once told to stop: take no new client, and let go of the ones with nothing left to write
+        if (worker_stopping && accepting)
+        {
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, listen_fd, nullptr);
+            accepting = false;
+
+            vector<int> idle;
+            for (const auto &client : clients)
+            {
+                if (client.second->output.empty() && !client.second->query)
+                {
+                    idle.push_back(client.first);
+                }
+            }
+            for (int fd : idle)
+            {
+                drop(fd);
+            }
+            continue;
+        }
+
+        struct epoll_event events[64];
+        int ready = epoll_wait(epoll_fd, events, 64, 1000);
+
+        for (int e = 0; e < ready; e++)
+        {
+            int fd = events[e].data.fd;
+
+            if (fd == listen_fd)
+            {
+                int client_fd;
+                while (accepting && (client_fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1)
+                {
+                    clients[client_fd].reset(new ServeClient(client_fd));
+
+                    struct epoll_event event = {};
+                    event.events = EPOLLIN;
+                    event.data.fd = client_fd;
+                    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_fd, &event);
+                }
+                continue;
+            }
+
+            auto found = clients.find(fd);
+            if (found == clients.end())
+            {
+                continue;
+            }
+            ServeClient &client = *found->second;
+
+            if ((events[e].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && !client.closing && !client.input_ended && !client.query)
+            {
+                ssize_t read_byte = client.reader.read_some();
+
+                if (read_byte == 0)
+                {
+                    client.input_ended = true;
+                }
+                else if (read_byte == -1 && errno != EAGAIN)
+                {
+                    drop(fd);
+                    continue;
+                }
+            }
+
+            /*
+                answer the queries read so far, while the answers waiting are few enough
+                a query goes on by one slice per event: a client with a query going asks for EPOLLOUT,
+                so epoll comes back to it after the other clients ready, and the clients take turns
+            */
+            const char *request;
+            size_t length;
+            while (!client.query && !client.closing && client.output.size() < EDGE_LIMIT && client.reader.has_buffered_frame())
+            {
+                if (client.reader.next(request, length) == 1)
+                {
+                    client.query.reset(start_query(listing, request, length, client.output));
+                }
+                else
+                {
+                    client.closing = true;
+                }
+            }
+            if (client.query && client.output.size() < EDGE_LIMIT && continue_query(listing, *client.query, client.output))
+            {
+                client.query.reset();
+            }
+
+            // write what the socket takes
+            while (client.sent < client.output.size())
+            {
+                ssize_t write_byte = write(fd, client.output.data() + client.sent, client.output.size() - client.sent);
+                if (write_byte == -1)
+                {
+                    if (errno == EINTR)
+                    {
+                        continue;
+                    }
+                    break;
+                }
+                client.sent += write_byte;
+            }
+
+            if (client.sent == client.output.size())
+            {
+                client.output.clear();
+                client.sent = 0;
+            }
+            else if (errno != EAGAIN)
+            {
+                drop(fd);
+                continue;
+            }
+
+            // a client that closed its side goes once every whole request it sent is answered (a request cut short is not)
+            bool finished = client.closing || (client.input_ended && !client.reader.has_buffered_frame());
+            if ((finished || worker_stopping) && client.output.empty() && !client.query)
+            {
+                drop(fd);
+                continue;
+            }
+
+            /*
+                read while no query is going and the answers waiting are few enough
+                write while there are any, or more to come: of the query going, or of a request read already
+                (the socket holds no more of it, so EPOLLIN would not come back to it)
+            */
+            bool more_to_answer = client.query || (!client.closing && client.reader.has_buffered_frame());
+            struct epoll_event event = {};
+            event.events = (!client.query && !client.closing && !client.input_ended && client.output.size() < EDGE_LIMIT ? uint32_t(EPOLLIN) : 0) |
+                           (client.output.empty() && !more_to_answer ? 0 : uint32_t(EPOLLOUT));
+            event.data.fd = fd;
+            epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event);
+        }
+    }
+
+    _exit(0);
+}
+#endif
+
+/*
+    serve queries on the listing of "~/[path]" (see Daemon mode above), until SIGINT or SIGTERM
+
+    the server process itself only keeps the workers going: it waits for its signals with sigwaitinfo,
+    forks a new worker for one that died, and reloads the listing on SIGHUP
+*/
+void serve(string parent_process, PipelineOptions options)
+{
+#ifdef __linux__
+    struct sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (options.serve_socket.size() >= sizeof(address.sun_path))
+    {
+        fprintf(stderr, "\nSocket Path Too Long: %s\n", options.serve_socket.c_str());
+        return;
+    }
+    strcpy(address.sun_path, options.serve_socket.c_str());
+
+    if (!remove_stale_socket(address))
+    {
+        return;
+    }
+
+    SharedListing listing;
+    if (!load_listing(parent_process, options, listing, 0))
+    {
+        return;
+    }
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    // the socket file of this server: at exit, it is removed only if it is still this one
+    struct stat socket_status;
+
+    if (listen_fd == -1 || ::bind(listen_fd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) == -1 ||
+        listen(listen_fd, SOMAXCONN) == -1 || lstat(address.sun_path, &socket_status) == -1)
+    {
+        fprintf(stderr, "\nSocket Creation Failed: %s\n", strerror(errno));
+        if (listen_fd != -1)
+        {
+            close(listen_fd);
+        }
+        munmap(listing.data, listing.mapping_size);
+        return;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    // the signals of the server are taken in turn by sigwaitinfo, so block them; a worker unblocks them again
+    sigset_t signals, old_mask;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGHUP);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &signals, &old_mask);
+
+    int worker_count = options.workers > 0 ? options.workers : walker_thread_count();
+
+    // the workers on the current listing, and the ones finishing their clients on an older one
+    vector<pid_t> workers;
+    vector<pid_t> retiring;
+
+    auto start_worker = [&]()
+    {
+        fflush(stdout);
+
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            serve_worker(listen_fd, listing, old_mask);
+        }
+        if (pid < 0)
+        {
+            fprintf(stderr, "\nFork Failed\n");
+            return;
+        }
+        workers.push_back(pid);
+    };
+
+    for (int i = 0; i < worker_count; i++)
+    {
+        start_worker();
+    }
+
+    printf("SERVE: %zu records (%zu bytes) of %s, on %s, with %zu workers\n", listing.records, listing.length,
+           parent_process.c_str(), options.serve_socket.c_str(), workers.size());
+    fflush(stdout);
+
+    bool stopping = false;
+
+    while (!workers.empty() || !retiring.empty())
+    {
+        siginfo_t info;
+        if (sigwaitinfo(&signals, &info) == -1)
+        {
+            continue;
+        }
+
+        if ((info.si_signo == SIGINT || info.si_signo == SIGTERM) && !stopping)
+        {
+            stopping = true;
+            retiring.insert(retiring.end(), workers.begin(), workers.end());
+            workers.clear();
+
+            for (pid_t pid : retiring)
+            {
+                kill(pid, SIGTERM);
+            }
+        }
+        else if (info.si_signo == SIGHUP && !stopping)
+        {
+            auto time_begin = chrono::steady_clock::now();
+
+            SharedListing reloaded;
+            if (!load_listing(parent_process, options, reloaded, listing.generation + 1))
+            {
+                fprintf(stderr, "\nReload Failed: the listing of generation %u is kept\n", listing.generation);
+                continue;
+            }
+
+            // the old workers keep their own view of the old listing until they exit
+            munmap(listing.data, listing.mapping_size);
+            listing = reloaded;
+
+            for (pid_t pid : workers)
+            {
+                kill(pid, SIGTERM);
+                retiring.push_back(pid);
+            }
+            workers.clear();
+
+            for (int i = 0; i < worker_count; i++)
+            {
+                start_worker();
+            }
+
+            printf("RELOAD: generation %u, %zu records (%zu bytes), in %.3f milliseconds (ms)\n", listing.generation,
+                   listing.records, listing.length,
+                   chrono::duration<double, milli>(chrono::steady_clock::now() - time_begin).count());
+            fflush(stdout);
+        }
+
+        // reap the workers that exited; one that was not told to stop is replaced
+        pid_t pid;
+        while ((pid = waitpid(-1, nullptr, WNOHANG)) > 0)
+        {
+            auto retired = find(retiring.begin(), retiring.end(), pid);
+            if (retired != retiring.end())
+            {
+                retiring.erase(retired);
+                continue;
+            }
+
+            auto worker = find(workers.begin(), workers.end(), pid);
+            if (worker != workers.end())
+            {
+                workers.erase(worker);
+                fprintf(stderr, "\nWorker %d exited, starting another\n", pid);
+                start_worker();
+            }
+        }
+    }
+
+    close(listen_fd);
+    struct stat current_status;
+    if (lstat(address.sun_path, &current_status) == 0 && current_status.st_dev == socket_status.st_dev &&
+        current_status.st_ino == socket_status.st_ino)
+    {
+        unlink(address.sun_path);
+    }
+    munmap(listing.data, listing.mapping_size);
+
+    sigprocmask(SIG_SETMASK, &old_mask, nullptr);
+#else
+    fprintf(stderr, "\n--serve needs epoll (Linux)\n");
+#endif
+}
+
+// send a query to the server on --query, and display its answer, as the pipeline would
+void query_server(vector<string> seeking_files, PipelineOptions options)
+{
+    auto time_begin = chrono::steady_clock::now();
+
+    struct sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (options.query_socket.size() >= sizeof(address.sun_path))
+    {
+        fprintf(stderr, "\nSocket Path Too Long: %s\n", options.query_socket.c_str());
+        return;
+    }
+    strcpy(address.sun_path, options.query_socket.c_str());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1 || connect(fd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) == -1)
+    {
+        fprintf(stderr, "\nFailed to connect to the server on \"%s\": %s\n", options.query_socket.c_str(), strerror(errno));
+        if (fd != -1)
+        {
+            close(fd);
+        }
+        return;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    // the hits name the patterns by id, so seek for the same names here, to display them
+    CustomGrep child_process(seeking_files);
+
+    string request(1, QUERY_REQUEST);
+    for (const string &name : seeking_files)
+    {
+        request += name;
+        request += '\0';
+    }
+    if (request.size() > MAX_QUERY_SIZE)
+    {
+        fprintf(stderr, "\nQuery Failed: the names seeking for take more than %zu bytes\n", MAX_QUERY_SIZE);
+        close(fd);
+        return;
+    }
+
+    QueryStats stats = {};
+    bool answered = false;
+
+    if (!write_frame(fd, request.data(), request.size()))
+    {
+        report_io_error();
+    }
+    else
+    {
+        FrameReader reader(fd, 2 * BUFFER_SIZE);
+        const char *data;
+        size_t length;
+        int status;
+
+        while ((status = reader.next(data, length)) == 1)
+        {
+            if (data[0] == RESULT_HITS)
+            {
+                display_results(data + 1, length - 1);
+            }
+            else if (data[0] == RESULT_STATS && length == 1 + sizeof(stats))
+            {
+                memcpy(&stats, data + 1, sizeof(stats));
+                answered = true;
+            }
+            else if (data[0] == RESULT_ERROR)
+            {
+                fprintf(stderr, "\nServer Error: %.*s\n", int(length - 1), data + 1);
+            }
+        }
+
+        if (status == -1)
+        {
+            report_io_error();
+        }
+
+        write_end_frame(fd);
+    }
+
+    close(fd);
+
+    auto time_end = chrono::steady_clock::now();
+
+    child_process.report();
+
+    if (answered)
+    {
+        printf("QUERY: %llu matches in %llu records, by worker %u on listing generation %u\n",
+               (unsigned long long)stats.matches, (unsigned long long)stats.records, stats.worker_pid, stats.generation);
+        printf("\nEstimated Match Time: %.3f microseconds (us)\n", stats.match_ns / 1e3);
+        printf("Estimated Server Time: %.3f microseconds (us)\n", stats.server_ns / 1e3);
+        printf("Estimated Round Trip Time: %.3f microseconds (us)\n\n",
+               chrono::duration<double, micro>(time_end - time_begin).count());
+    }
+}
+
+/*
+    LatencyHistogram class counts durations in nanoseconds, for their percentiles
+
+    durations below 64 ns are counted exactly; above that, each power of two is split into 64 buckets,
+    so a percentile is off by less than 1/64 (about 1.6%) of its value, from a nanosecond up to centuries
+*/
+class LatencyHistogram
+{
+private:
+    static const int SUB_BITS = 6;
+    static const uint64_t SUB_COUNT = 1 << SUB_BITS;
+
+    vector<uint64_t> counts;
+    uint64_t total = 0;
+    uint64_t sum = 0;
+    uint64_t minimum = UINT64_MAX;
+    uint64_t maximum = 0;
+
+    static size_t bucket(uint64_t value)
+    {
+        if (value < SUB_COUNT)
+        {
+            return value;
+        }
+
+        int magnitude = 63 - __builtin_clzll(value);
+        return ((magnitude - SUB_BITS + 1) << SUB_BITS) + ((value >> (magnitude - SUB_BITS)) & (SUB_COUNT - 1));
+    }
+
+    // the middle of the values counted in the bucket
+    static uint64_t bucket_value(size_t index)
+    {
+        if (index < SUB_COUNT)
+        {
+            return index;
+        }
+
+        int shift = (index >> SUB_BITS) - 1;
+        uint64_t lowest = (SUB_COUNT + (index & (SUB_COUNT - 1))) << shift;
+        return lowest + (uint64_t(1) << shift) / 2;
+    }
+
+public:
+    LatencyHistogram() : counts(bucket(UINT64_MAX) + 1) {}
+
+    void record(uint64_t nanoseconds)
+    {
+        counts[bucket(nanoseconds)]++;
+        total++;
+        sum += nanoseconds;
+        minimum = min(minimum, nanoseconds);
+        maximum = max(maximum, nanoseconds);
+    }
+
+    uint64_t count() const
+    {
+        return total;
+    }
+
+    uint64_t min_value() const
+    {
+        return total ? minimum : 0;
+    }
+
+    uint64_t max_value() const
+    {
+        return maximum;
+    }
+
+    double mean() const
+    {
+        return total ? double(sum) / total : 0;
+    }
+
+    // the duration that "percent" of the counted durations do not exceed
+    uint64_t percentile(double percent) const
+    {
+        uint64_t rank = uint64_t(percent / 100 * total + 0.5);
+        rank = max(rank, uint64_t(1));
+
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts.size(); i++)
+        {
+            seen += counts[i];
+            if (seen >= rank)
+            {
+                return min(max(bucket_value(i), min_value()), maximum);
+            }
+        }
+
+        return maximum;
+    }
+};
+
+// the result of the benchmark of one transport at one message size
+struct BenchmarkResult
+{
+    string transport;
+    size_t message_size = 0;
+    bool failed = false;
+
+    // one way: messages sent back to back, as the pipeline does
+    size_t messages = 0;
+    double seconds = 0;
+    double parent_cpu_us = 0;
+
+    // round trips: a message sent, and the same message sent back
+    LatencyHistogram latency;
+};
+
+// create a transport of the given name, able to carry messages of "message_size" bytes
+Transport *create_benchmark_transport(PipelineOptions options, const string &name, size_t message_size)
+{
+    if (name == "splice")
+    {
+        return new SpliceTransport(options.pipe_capacity, message_size);
+    }
+    if (name == "pipe")
+    {
+        return new PipeTransport(options.pipe_capacity, max(MAX_FRAME_SIZE, message_size));
+    }
+    if (name == "socketpair")
+    {
+        return new SocketpairTransport(options.pipe_capacity, max(MAX_FRAME_SIZE, message_size));
+    }
+
+    // the ring holds a record of at most half its capacity; keep room for a few of them
+    options.transport = name;
+    options.ring_capacity = max(options.ring_capacity, 4 * (message_size + 8));
+
+    return create_transport(options);
+}
+
+// produce a message in place: touch a word in every cache line, as building a real one would
+void fill_message(char *message, size_t length, uint64_t value)
+{
+    for (size_t offset = 0; offset + sizeof(value) <= length; offset += 64)
+    {
+        memcpy(message + offset, &value, sizeof(value));
+    }
+}
+
+/*
+    the parent sends "messages" messages of "message_size" bytes back to back, built in place (reserve and commit),
+    and the child receives them and reads every byte, as a consumer would
+    the time runs from the fork until the child has read the last message and exited
+*/
+void measure_throughput(const PipelineOptions &options, BenchmarkResult &result, size_t messages)
+{
+    unique_ptr<Transport> transport(create_benchmark_transport(options, result.transport, result.message_size));
+
+    if (!transport->open())
+    {
+        result.failed = true;
+        return;
+    }
+
+    auto time_begin = chrono::steady_clock::now();
+    clock_t cpu_begin = clock();
+
+    pid_t pid = fork();
+
+    if (pid < 0)
+    {
+        fprintf(stderr, "\nFork Failed\n");
+        result.failed = true;
+        return;
+    }
+
+    /* Child process (Consumer)*/
+    if (pid == 0)
+    {
+        transport->consumer_side();
+
+        const char *data;
+        size_t length;
+        unsigned long checksum = 0;
+        int status;
+
+        while ((status = transport->receive(data, length)) == 1)
+        {
+            for (size_t i = 0; i + sizeof(unsigned long) <= length; i += sizeof(unsigned long))
+            {
+                unsigned long word;
+                memcpy(&word, data + i, sizeof(word));
+                checksum += word;
+            }
+        }
+
+        // keep the checksum from being optimized away
+        _exit(status == 0 && checksum != 1 ? 0 : 1);
+    }
+
+    /* Parent process (Producer)*/
+    transport->producer_side();
+
+    bool failed = false;
+    for (size_t i = 0; i < messages && !failed; i++)
+    {
+        char *message = transport->reserve(result.message_size);
+        if (!message)
+        {
+            failed = true;
+            break;
+        }
+
+        fill_message(message, result.message_size, i);
+
+        failed = !transport->commit(result.message_size);
+    }
+
+    if (failed || !transport->finish())
+    {
+        report_io_error();
+        failed = true;
+    }
+
+    clock_t cpu_end = clock();
+    transport.reset();
+
+    int status;
+    waitpid(pid, &status, 0);
+
+    auto time_end = chrono::steady_clock::now();
+
+    result.failed = failed || !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+    result.messages = messages;
+    result.seconds = chrono::duration<double>(time_end - time_begin).count();
+    result.parent_cpu_us = 1e6 * (cpu_end - cpu_begin) / CLOCKS_PER_SEC;
+}
+
+/*
+    the parent sends a message through one transport, and the child sends it back through another,
+    "round_trips" times; the first tenth warms up the caches and the scheduler, and is not counted
+*/
+void measure_latency(const PipelineOptions &options, BenchmarkResult &result, size_t round_trips)
+{
+    unique_ptr<Transport> request(create_benchmark_transport(options, result.transport, result.message_size));
+    unique_ptr<Transport> response(create_benchmark_transport(options, result.transport, result.message_size));
+
+    if (!request->open() || !response->open())
+    {
+        result.failed = true;
+        return;
+    }
+
+    pid_t pid = fork();
+
+    if (pid < 0)
+    {
+        fprintf(stderr, "\nFork Failed\n");
+        result.failed = true;
+        return;
+    }
+
+    /* Child process (echoes every message back)*/
+    if (pid == 0)
+    {
+        request->consumer_side();
+        response->producer_side();
+
+        const char *data;
+        size_t length;
+        int status;
+
+        while ((status = request->receive(data, length)) == 1)
+        {
+            if (!response->send(data, length))
+            {
+                _exit(1);
+            }
+        }
+
+        _exit(status == 0 && response->finish() ? 0 : 1);
+    }
+
+    /* Parent process*/
+    request->producer_side();
+    response->consumer_side();
+
+    size_t warm_up = round_trips / 10;
+    bool failed = false;
+
+    for (size_t i = 0; i < warm_up + round_trips && !failed; i++)
+    {
+        auto time_sent = chrono::steady_clock::now();
+
+        char *message = request->reserve(result.message_size);
+        if (!message)
+        {
+            failed = true;
+            break;
+        }
+
+        fill_message(message, result.message_size, i);
+
+        if (!request->commit(result.message_size))
+        {
+            failed = true;
+            break;
+        }
+
+        const char *data;
+        size_t length;
+        if (response->receive(data, length) != 1 || length != result.message_size)
+        {
+            failed = true;
+            break;
+        }
+
+        auto time_received = chrono::steady_clock::now();
+
+        if (i >= warm_up)
+        {
+            result.latency.record(chrono::duration_cast<chrono::nanoseconds>(time_received - time_sent).count());
+        }
+    }
+
+    if (failed || !request->finish())
+    {
+        report_io_error();
+        failed = true;
+    }
+
+    // drain the end of the stream from the child, then let it go
+    const char *data;
+    size_t length;
+    if (!failed)
+    {
+        failed = response->receive(data, length) != 0;
+    }
+
+    request.reset();
+    response.reset();
+
+    int status;
+    waitpid(pid, &status, 0);
+
+    result.failed = result.failed || failed || !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+}
+
+// write the results as a JSON document
+void write_benchmark_json(FILE *output, const PipelineOptions &options, const vector<BenchmarkResult> &results)
+{
+    fprintf(output, "{\n  \"benchmark\": \"transports\",\n  \"pipe_capacity\": %d,\n  \"ring_capacity\": %zu,\n  \"results\": [",
+            options.pipe_capacity, options.ring_capacity);
+
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const BenchmarkResult &result = results[i];
+        double megabytes = double(result.messages) * result.message_size / (1 << 20);
+        const LatencyHistogram &latency = result.latency;
+
+        fprintf(output, "%s\n    {\"transport\": \"%s\", \"message_size\": %zu, \"ok\": %s,\n",
+                i ? "," : "", result.transport.c_str(), result.message_size, result.failed ? "false" : "true");
+        fprintf(output, "     \"throughput\": {\"messages\": %zu, \"seconds\": %.6f, \"mb_per_s\": %.1f, \"records_per_s\": %.0f, "
+                        "\"parent_cpu_us_per_mb\": %.2f},\n",
+                result.messages, result.seconds, result.seconds > 0 ? megabytes / result.seconds : 0,
+                result.seconds > 0 ? result.messages / result.seconds : 0, megabytes > 0 ? result.parent_cpu_us / megabytes : 0);
+        fprintf(output, "     \"latency_ns\": {\"round_trips\": %llu, \"min\": %llu, \"mean\": %.0f, \"p50\": %llu, \"p90\": %llu, "
+                        "\"p99\": %llu, \"p99_9\": %llu, \"max\": %llu}}",
+                (unsigned long long)latency.count(), (unsigned long long)latency.min_value(), latency.mean(),
+                (unsigned long long)latency.percentile(50), (unsigned long long)latency.percentile(90),
+                (unsigned long long)latency.percentile(99), (unsigned long long)latency.percentile(99.9),
+                (unsigned long long)latency.max_value());
+    }
+
+    fprintf(output, "\n  ]\n}\n");
+}
+
+/*
+    compare the transports: throughput (MB/s, records/s) and round-trip latency, at message sizes from 64B to 1MB
+
+    each size sends up to 256 MB one way (at most 256K messages), and makes up to 10000 round trips
+    the results come out as JSON (on stdout, or in the file of --benchmark-json), and as a table on stderr
+*/
+void benchmark_transports(PipelineOptions options)
+{
+    const char *transports[] = {"pipe", "socketpair", "splice", "shm"};
+    const size_t message_sizes[] = {64, 256, 1 << 10, 4 << 10, 16 << 10, 64 << 10, 256 << 10, 1 << 20};
+    const size_t total_byte = size_t(256) << 20;
+
+    signal(SIGPIPE, SIG_IGN);
+
+    // flush the output so far, or a child would write it once more on exit
+    fflush(stdout);
+
+    fprintf(stderr, "\n%-11s %8s %11s %13s %10s %10s %10s %10s\n", "Transport", "Size", "MB/s", "records/s", "p50 ns",
+            "p99 ns", "p99.9 ns", "max ns");
+
+    vector<BenchmarkResult> results;
+
+    for (size_t message_size : message_sizes)
+    {
+        for (const char *name : transports)
+        {
+            BenchmarkResult result;
+            result.transport = name;
+            result.message_size = message_size;
+
+            size_t messages = min(total_byte / message_size, size_t(256) << 10);
+            size_t round_trips = min(max((size_t(32) << 20) / message_size, size_t(100)), size_t(10000));
+
+            measure_throughput(options, result, messages);
+            if (!result.failed)
+            {
+                measure_latency(options, result, round_trips);
+            }
+
+            double megabytes = double(result.messages) * message_size / (1 << 20);
+            fprintf(stderr, "%-11s %8zu %11.1f %13.0f %10llu %10llu %10llu %10llu%s\n", name, message_size,
+                    result.seconds > 0 ? megabytes / result.seconds : 0, result.seconds > 0 ? result.messages / result.seconds : 0,
+                    (unsigned long long)result.latency.percentile(50), (unsigned long long)result.latency.percentile(99),
+                    (unsigned long long)result.latency.percentile(99.9), (unsigned long long)result.latency.max_value(),
+                    result.failed ? "   (FAILED)" : "");
+
+            results.push_back(move(result));
+        }
+    }
+
+    FILE *output = stdout;
+    if (!options.benchmark_json.empty())
+    {
+        output = fopen(options.benchmark_json.c_str(), "w");
+        if (!output)
+        {
+            fprintf(stderr, "\nFailed to write the results to \"%s\": %s\n", options.benchmark_json.c_str(), strerror(errno));
+            return;
+        }
+    }
+
+    write_benchmark_json(output, options, results);
+
+    if (output != stdout)
+    {
+        fclose(output);
+    }
+}
+
+PatternMatcher CustomGrep::matcher;
+size_t CustomGrep::match_count = 0;
+
+// read the options from the command line; return false for an unknown option
+bool parse_options(int argc, char *argv[], PipelineOptions &options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        string option = argv[i];
+
+        if (option.compare(0, 12, "--transport=") == 0)
+        {
+            options.transport = option.substr(12);
+        }
+        else if (option.compare(0, 12, "--pipe-size=") == 0)
+        {
+            options.pipe_capacity = atoi(option.c_str() + 12);
+        }
+        else if (option.compare(0, 12, "--ring-size=") == 0)
+        {
+            options.ring_capacity = strtoull(option.c_str() + 12, nullptr, 10);
+        }
+        else if (option == "--benchmark")
+        {
+            options.benchmark = true;
+        }
+        else if (option.compare(0, 17, "--benchmark-json=") == 0)
+        {
+            options.benchmark = true;
+            options.benchmark_json = option.substr(17);
+        }
+        else if (option.compare(0, 12, "--consumers=") == 0)
+        {
+            options.consumers = atoi(option.c_str() + 12);
+        }
+        else if (option.compare(0, 8, "--split=") == 0)
+        {
+            options.split = option.substr(8);
+        }
+        else if (option == "--ordered")
+        {
+            options.ordered = true;
+        }
+        else if (option.compare(0, 16, "--record-fields=") == 0)
+        {
+            // a comma-separated list of: inode, size, parent
+            stringstream fields(option.substr(16));
+            string field;
+            while (getline(fields, field, ','))
+            {
+                if (field == "inode")
+                {
+                    options.record_fields |= RECORD_INODE;
+                }
+                else if (field == "size")
+                {
+                    options.record_fields |= RECORD_SIZE;
+                }
+                else if (field == "parent")
+                {
+                    options.record_fields |= RECORD_PARENT | RECORD_DIRECTORY_ID;
+                }
+                else
+                {
+                    fprintf(stderr, "Unknown record field: %s\n", field.c_str());
+                    return false;
+                }
+            }
+        }
+        else if (option.compare(0, 11, "--pipeline=") == 0)
+        {
+            // stages separated by "|", each "kind[:argument]", with "@fork" to run it in a process of its own
+            stringstream stages(option.substr(11));
+            string stage;
+            while (getline(stages, stage, '|'))
+            {
+                StageSpec spec;
+
+                if (stage.size() > 5 && stage.compare(stage.size() - 5, 5, "@fork") == 0)
+                {
+                    spec.forked = true;
+                    stage.resize(stage.size() - 5);
+                }
+
+                size_t colon = stage.find(':');
+                spec.kind = stage.substr(0, colon);
+                if (colon != string::npos)
+                {
+                    spec.argument = stage.substr(colon + 1);
+                }
+
+                if (spec.kind != "grep" && spec.kind != "sort" && spec.kind != "dedupe" && spec.kind != "count")
+                {
+                    fprintf(stderr, "Unknown stage: %s\n", stage.c_str());
+                    return false;
+                }
+
+                options.stages.push_back(spec);
+            }
+        }
+        else if (option == "--io-uring")
+        {
+            options.io_uring = true;
+        }
+        else if (option.compare(0, 8, "--serve=") == 0)
+        {
+            options.serve_socket = option.substr(8);
+        }
+        else if (option.compare(0, 10, "--workers=") == 0)
+        {
+            options.workers = atoi(option.c_str() + 10);
+        }
+        else if (option.compare(0, 8, "--query=") == 0)
+        {
+            options.query_socket = option.substr(8);
+        }
+        else if (option.compare(0, 8, "--index=") == 0)
+        {
+            options.index_file = option.substr(8);
+        }
+        else if (option.compare(0, 11, "--patterns=") == 0)
+        {
+            ifstream file(option.substr(11));
+            if (!file)
+            {
+                fprintf(stderr, "Failed to open the patterns \"%s\"\n", option.c_str() + 11);
+                return false;
+            }
+
+            string pattern;
+            while (getline(file, pattern))
+            {
+                if (!pattern.empty())
+                {
+                    options.patterns.push_back(pattern);
+                }
+            }
+        }
+        else
+        {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            fprintf(stderr, "Usage: %s [--transport=pipe|socketpair|splice|shm] [--pipe-size=BYTES] [--ring-size=BYTES]\n"
+                            "       [--benchmark] [--benchmark-json=FILE]\n"
+                            "       [--consumers=N] [--split=round-robin|directory] [--ordered] [--patterns=FILE]\n"
+                            "       [--index=FILE] [--record-fields=inode,size,parent]\n"
+                            "       [--pipeline=STAGE|STAGE...] (STAGE: grep[:NAMES], sort, dedupe or count, with @fork)\n"
+                            "       [--serve=SOCKET] [--workers=N] [--query=SOCKET] [--io-uring]\n", argv[0]);
+            return false;
+        }
+    }
+
+    // UringWalker neither keeps a batch to a directory nor reports the directories an index needs
+    if (options.io_uring && options.split == "directory")
+    {
+        fprintf(stderr, "--io-uring cannot be used with --split=directory\n");
+        return false;
+    }
+    if (options.io_uring && !options.index_file.empty())
+    {
+        fprintf(stderr, "--io-uring cannot be used with --index\n");
+        return false;
+    }
+
+    return true;
+}
+
+#ifndef IPC_TEST
+// the main function to execute the program (IPC_test.cpp compiles this file without it, see the README)
+int main(int argc, char *argv[])
+{
+    PipelineOptions options;
+
+    if (!parse_options(argc, argv, options))
+    {
+        return 1;
+    }
+
+    if (options.benchmark)
+    {
+        benchmark_transports(options);
+        return 0;
+    }
+
+    string directory;
+
+    // prompt a name of a directory (a query asks the server, which has its own)
+    if (options.query_socket.empty())
+    {
+        cout << "\nThis pipeline is for two specific processes: \"ls\" and \"CustomGrep\".\n\nPlease type a name of a directory: ls ~/";
+
+        cin >> directory;
+    }
+
+    // prompt the name(s) of a file seeking for, separated by spaces
+    // a name may be a shell-style glob, e.g. "*.txt"
+    // (a pipeline of stages needs them only for a "grep" stage without names of its own, and a server never)
+    bool names_needed = options.stages.empty() && options.serve_socket.empty();
+    for (const StageSpec &spec : options.stages)
+    {
+        names_needed = names_needed || (spec.kind == "grep" && spec.argument.empty());
+    }
+
+    vector<string> seeking_files = options.patterns;
+    if (seeking_files.empty() && names_needed)
+    {
+        cout << "\nPlease type a name of a file or directory: ";
+
+        string line, seeking_file;
+        getline(cin >> ws, line);
+        stringstream names(line);
+        while (names >> seeking_file)
+        {
+            seeking_files.push_back(seeking_file);
+        }
+    }
+
+    // break a new line
+    cout << "\n"
+         << endl;
+
+    if (!options.query_socket.empty())
+    {
+        query_server(seeking_files, options);
+        return 0;
+    }
+
+    // "~" is expanded by the shell for "ls", so resolve it from the environment here
+    const char *home = getenv("HOME");
+    string path = string(home ? home : ".") + "/" + directory;
+
+    // an index answers without listing the directory; otherwise, a single consumer keeps the plain pipeline
+    if (!options.serve_socket.empty())
+    {
+        serve(path, options);
+    }
+    else if (!options.stages.empty())
+    {
+        stage_pipeline(path, seeking_files, options);
+    }
+    else if (!options.index_file.empty())
+    {
+        index_search(path, CustomGrep(seeking_files), options);
+    }
+    else if (options.consumers == 1)
+    {
+        pipeline(path, CustomGrep(seeking_files), options);
+    }
+    else if (!fan_out_pipeline(path, CustomGrep(seeking_files), options))
+    {
+        return 1;
+    }
+
+    return 0;
+}
+#endif
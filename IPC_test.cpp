@@ -0,0 +1,966 @@
+/*
+ *  Project B: Inter-Process Communication (IPC)
+ *  Name: Brien Kim
+ *  Course: CS 3502 Section W03
+ *  NetID: bkim50
+ *
+ *  Overview: the tests of IPC.cpp
+ *
+ *  IPC.cpp is compiled into this file, without its main function, so the tests reach its classes and functions directly
+ *  each test checks a part of IPC.cpp against a simpler (or a system) implementation of the same thing
+ */
+#define IPC_TEST
+#include "IPC.cpp"
+
+#include <fnmatch.h>
+#include <ftw.h>
+#include <thread>
+
+// the number of checks failed so far
+int failures = 0;
+
+#define CHECK(condition) check((condition), #condition, __FILE__, __LINE__)
+
+void check(bool passed, const char *condition, const char *file, int line)
+{
+    if (!passed)
+    {
+        fprintf(stderr, "%s:%d: FAILED: %s\n", file, line, condition);
+        failures++;
+    }
+}
+
+/*
+    FrameReader: frames written a few bytes at a time come out whole, and in order
+    a header over the limit, or a stream cut short, is an error, not a frame
+*/
+void test_frame_reader()
+{
+    vector<string> frames;
+    for (size_t length : {size_t(1), size_t(7), size_t(100), size_t(BUFFER_SIZE), size_t(3 * BUFFER_SIZE + 5)})
+    {
+        string frame(length, '\0');
+        for (size_t i = 0; i < length; i++)
+        {
+            frame[i] = char('a' + (i * 7 + length) % 26);
+        }
+        frames.push_back(frame);
+    }
+
+    string stream;
+    for (const string &frame : frames)
+    {
+        append_frame(stream, frame.data(), frame.size());
+    }
+    append_frame(stream, nullptr, 0);
+
+    // short reads: the stream goes into the pipe in pieces of a few bytes, each read on its own
+    int fd[2];
+    CHECK(pipe(fd) == 0);
+
+    thread writer([&]
+                  {
+        for (size_t i = 0; i < stream.size();)
+        {
+            size_t piece = min(stream.size() - i, size_t(1 + i % 5));
+            if (i < 64)
+            {
+                usleep(100);
+            }
+            write_all(fd[WRITE_END], stream.data() + i, piece);
+            i += piece;
+        }
+        close(fd[WRITE_END]); });
+
+    FrameReader reader(fd[READ_END], 16);
+    const char *data;
+    size_t length;
+    for (const string &frame : frames)
+    {
+        CHECK(reader.next(data, length) == 1);
+        CHECK(string(data, length) == frame);
+    }
+    CHECK(reader.next(data, length) == 0);
+
+    writer.join();
+    close(fd[READ_END]);
+
+    // a header over the limit of the reader
+    CHECK(pipe(fd) == 0);
+    string oversized;
+    FrameHeader header = 1000;
+    oversized.append(reinterpret_cast<const char *>(&header), sizeof(header));
+    oversized.append(1000, 'x');
+    write_all(fd[WRITE_END], oversized.data(), oversized.size());
+
+    FrameReader limited(fd[READ_END], 64, 999);
+    errno = 0;
+    CHECK(limited.next(data, length) == -1 && errno == EMSGSIZE);
+    close(fd[READ_END]);
+    close(fd[WRITE_END]);
+
+    // the same through read_some, on a non-blocking descriptor, as a worker of the server reads
+    CHECK(pipe(fd) == 0);
+    fcntl(fd[READ_END], F_SETFL, O_NONBLOCK);
+    write_all(fd[WRITE_END], oversized.data(), sizeof(header));
+
+    FrameReader non_blocking(fd[READ_END], 64, 999);
+    errno = 0;
+    CHECK(non_blocking.read_some() == -1 && errno == EMSGSIZE);
+    close(fd[READ_END]);
+    close(fd[WRITE_END]);
+
+    // a stream ending inside a frame
+    CHECK(pipe(fd) == 0);
+    string partial;
+    append_frame(partial, frames[2].data(), frames[2].size());
+    write_all(fd[WRITE_END], partial.data(), sizeof(FrameHeader) + 3);
+    close(fd[WRITE_END]);
+
+    FrameReader cut(fd[READ_END], 64);
+    errno = 0;
+    CHECK(cut.next(data, length) == -1 && errno == EPIPE);
+    close(fd[READ_END]);
+}
+
+/*
+    the substring kernels: every kernel the CPU runs finds the same first occurrence as std::search,
+    for needles of every length around the block sizes, at every offset and up to the very end of the haystack
+*/
+void test_substring_kernels()
+{
+    vector<pair<const char *, SubstringKernel>> kernels;
+    kernels.push_back(make_pair("scalar", find_substring_scalar));
+#ifdef IPC_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+    {
+        kernels.push_back(make_pair("sse2", find_substring_sse2));
+    }
+    if (__builtin_cpu_supports("avx2"))
+    {
+        kernels.push_back(make_pair("avx2", find_substring_avx2));
+    }
+#endif
+    kernels.push_back(make_pair("selected", find_substring));
+
+    // a small alphabet, so partial matches (the first and last bytes equal, the middle not) are common
+    srand(31);
+    for (int round = 0; round < 3000; round++)
+    {
+        size_t haystack_length = rand() % 200;
+        string haystack(haystack_length, '\0');
+        for (char &byte : haystack)
+        {
+            byte = "ab/\0"[rand() % 4];
+        }
+
+        size_t needle_length = rand() % 40;
+        string needle(needle_length, '\0');
+        for (char &byte : needle)
+        {
+            byte = "ab/\0"[rand() % 4];
+        }
+        // often a needle that does occur, taken from the haystack
+        if (round % 2 == 0 && needle_length <= haystack_length)
+        {
+            needle = haystack.substr(rand() % (haystack_length - needle_length + 1), needle_length);
+        }
+
+        // the haystack is copied to the heap at its exact size, so a read past its end is caught by a sanitizer
+        vector<char> bytes(haystack.begin(), haystack.end());
+        const char *begin = bytes.data();
+        const char *end = begin + bytes.size();
+
+        const char *expected = search(begin, end, needle.begin(), needle.end());
+        if (expected == end && needle_length > 0)
+        {
+            expected = nullptr;
+        }
+
+        for (const auto &kernel : kernels)
+        {
+            const char *found = kernel.second(begin, end, needle.data(), needle.size());
+            if (found != expected)
+            {
+                fprintf(stderr, "kernel %s: needle of %zu bytes in %zu bytes\n", kernel.first, needle_length, haystack_length);
+            }
+            CHECK(found == expected);
+        }
+    }
+}
+
+// the ids of the patterns of "matcher" matching the path "name", by PatternMatcher::match
+vector<uint32_t> matched_ids(PatternMatcher &matcher, const string &name)
+{
+    string records;
+    Record record = {};
+    record.name = name.data();
+    record.length = name.size();
+    append_record(records, record, "", 0);
+
+    vector<uint32_t> ids;
+    matcher.match(records.data(), records.size(), [&ids](const char *, size_t, uint32_t id)
+                  { ids.push_back(id); });
+    return ids;
+}
+
+/*
+    PatternMatcher: a glob matches a path as fnmatch matches the name after its last slash,
+    and a literal as strstr finds it in the whole path, each reported once per path
+*/
+void test_pattern_matcher()
+{
+    // the bracket expressions: "]" as a member, "[!...]", ranges, classes, escapes, and a "[" left open
+    const char *globs[] = {"[]a]*", "[!]a]*", "[!]", "[]", "a[", "[a-c]x", "[!a-c]x", "\\*x", "[\\]]", "[a\\-z]",
+                           "[a-]", "[[:digit:]]*", "[![:alpha:]]?", "[[:bogus:]]", "*[", "[^b]", "a[]b", "[z-a]",
+                           "[a-\\]]", "*.txt", "?", "*", "a*b*c", "*\\", "[x]\\"};
+    const char *names[] = {"]", "a", "b", "]x", "ax", "bx", "dx", "*x", "[", "a[", "-", "z", "1a", "1", "ab", "[]",
+                           "a]b", "ab]", "x", "\\", "x\\", "[:bogus:]", "^", "notes.txt", "d/notes.txt", "d.txt/x",
+                           "abc", "aXbYc", "acb", ""};
+
+    for (const char *glob : globs)
+    {
+        PatternMatcher matcher;
+        matcher.add(glob);
+        matcher.compile();
+
+        for (const char *name : names)
+        {
+            const char *slash = strrchr(name, '/');
+            bool expected = fnmatch(glob, slash ? slash + 1 : name, 0) == 0;
+            bool found = !matched_ids(matcher, name).empty();
+            if (found != expected)
+            {
+                fprintf(stderr, "glob \"%s\" on \"%s\": %d, fnmatch: %d\n", glob, name, found, expected);
+            }
+            CHECK(found == expected);
+        }
+    }
+
+    // random globs over the bytes that mean something in a glob
+    // (not "-": glibc reads a range in a "[" left open, e.g. "[?-", in a way of its own, so ranges are in the list above)
+    srand(32);
+    const char alphabet[] = "ab]![\\*?";
+    for (int round = 0; round < 5000; round++)
+    {
+        string glob;
+        for (int i = rand() % 7; i >= 0; i--)
+        {
+            glob += alphabet[rand() % (sizeof(alphabet) - 1)];
+        }
+        if (!PatternMatcher::is_glob(glob))
+        {
+            continue;
+        }
+
+        PatternMatcher matcher;
+        matcher.add(glob);
+        matcher.compile();
+
+        for (int k = 0; k < 10; k++)
+        {
+            string name;
+            for (int i = rand() % 4; i >= 0; i--)
+            {
+                name += alphabet[rand() % (sizeof(alphabet) - 1)];
+            }
+
+            bool expected = fnmatch(glob.c_str(), name.c_str(), 0) == 0;
+            bool found = !matched_ids(matcher, name).empty();
+            if (found != expected)
+            {
+                fprintf(stderr, "glob \"%s\" on \"%s\": %d, fnmatch: %d\n", glob.c_str(), name.c_str(), found, expected);
+            }
+            CHECK(found == expected);
+        }
+    }
+
+    // several patterns at once: each id reported once for a path, in order, literals found anywhere in the path
+    PatternMatcher matcher;
+    vector<string> patterns = {"txt", "*.txt", "no", "notes", "d/n", "[!.]*"};
+    for (const string &pattern : patterns)
+    {
+        matcher.add(pattern);
+    }
+    matcher.compile();
+
+    for (const char *name : names)
+    {
+        vector<uint32_t> expected;
+        for (uint32_t id = 0; id < patterns.size(); id++)
+        {
+            const string &pattern = patterns[id];
+            const char *slash = strrchr(name, '/');
+            bool hit = PatternMatcher::is_glob(pattern) ? fnmatch(pattern.c_str(), slash ? slash + 1 : name, 0) == 0
+                                                        : strstr(name, pattern.c_str()) != nullptr;
+            if (hit)
+            {
+                expected.push_back(id);
+            }
+        }
+        CHECK(matched_ids(matcher, name) == expected);
+    }
+}
+
+/*
+    records: every combination of the optional fields reads back as written, names up to the 16-bit length included,
+    a name one byte longer is refused, and a record cut short is not read at all
+*/
+void test_records()
+{
+    string records;
+    vector<Record> written;
+    vector<string> names;
+    for (uint8_t flags = 0; flags < 16; flags++)
+    {
+        names.push_back(string("dir/") + char('a' + flags));
+    }
+    names.push_back("");
+    names.push_back(string(MAX_RECORD_NAME - 4, 'n'));
+
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        // up to the first 4 bytes of a name go in as the prefix
+        size_t prefix_length = min(names[i].size(), size_t(4));
+
+        Record record = {};
+        record.name = names[i].data() + prefix_length;
+        record.length = names[i].size() - prefix_length;
+        record.type = i % 3 == 0 ? DT_DIR : DT_REG;
+        record.flags = i % 16;
+        record.inode = record.flags & RECORD_INODE ? 0x0123456789abcdefULL + i : 0;
+        record.size = record.flags & RECORD_SIZE ? UINT64_MAX - i : 0;
+        record.parent = record.flags & RECORD_PARENT ? uint32_t(i) : 0;
+        record.directory_id = record.flags & RECORD_DIRECTORY_ID ? UINT32_MAX - uint32_t(i) : 0;
+
+        CHECK(append_record(records, record, names[i].data(), prefix_length));
+        written.push_back(record);
+    }
+
+    const char *position = records.data();
+    const char *end = position + records.size();
+    Record record;
+    for (size_t i = 0; i < written.size(); i++)
+    {
+        position = read_record(position, end, record);
+        CHECK(position != nullptr);
+        if (position == nullptr)
+        {
+            return;
+        }
+        CHECK(string(record.name, record.length) == names[i]);
+        CHECK(record.type == written[i].type && record.flags == written[i].flags);
+        CHECK(record.inode == written[i].inode && record.size == written[i].size);
+        CHECK(record.parent == written[i].parent && record.directory_id == written[i].directory_id);
+    }
+    CHECK(position == end);
+
+    // a name over the 16-bit length, counting the prefix, appends nothing
+    string too_long(MAX_RECORD_NAME + 1, 'x');
+    Record record_too_long = {};
+    record_too_long.name = too_long.data() + 1;
+    record_too_long.length = too_long.size() - 1;
+    size_t size = records.size();
+    CHECK(!append_record(records, record_too_long, "/", 1));
+    CHECK(records.size() == size);
+
+    // every record cut short, in its header, its fields or its name, is not read
+    string single;
+    Record full = {};
+    full.name = "name";
+    full.length = 4;
+    full.flags = RECORD_INODE | RECORD_SIZE | RECORD_PARENT | RECORD_DIRECTORY_ID;
+    append_record(single, full, "", 0);
+    for (size_t length = 0; length < single.size(); length++)
+    {
+        CHECK(read_record(single.data(), single.data() + length, record) == nullptr);
+    }
+    CHECK(read_record(single.data(), single.data() + single.size(), record) == single.data() + single.size());
+
+    // PatternMatcher::match called again from inside "found", on the same matcher: the outer hits are kept
+    PatternMatcher matcher;
+    matcher.add("a");
+    matcher.add("*.c");
+    matcher.compile();
+
+    string batch;
+    for (const char *name : {"a.c", "b.c", "ab"})
+    {
+        Record file = {};
+        file.name = name;
+        file.length = strlen(name);
+        append_record(batch, file, "", 0);
+    }
+
+    vector<pair<string, uint32_t>> flat, nested;
+    matcher.match(batch.data(), batch.size(), [&flat](const char *name, size_t length, uint32_t id)
+                  { flat.push_back(make_pair(string(name, length), id)); });
+    matcher.match(batch.data(), batch.size(), [&](const char *name, size_t length, uint32_t id)
+                  {
+        nested.push_back(make_pair(string(name, length), id));
+        matcher.match(batch.data(), batch.size(), [](const char *, size_t, uint32_t) {}); });
+    CHECK(flat.size() == 4);
+    CHECK(nested == flat);
+}
+
+// a new, empty directory under /tmp
+string make_temporary_directory()
+{
+    char path[] = "/tmp/IPC_test.XXXXXX";
+    CHECK(mkdtemp(path) != nullptr);
+    return path;
+}
+
+int remove_entry(const char *path, const struct stat *, int, struct FTW *)
+{
+    return remove(path);
+}
+
+// remove "path" and everything under it
+void remove_tree(const string &path)
+{
+    nftw(path.c_str(), remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+/*
+    a tree of a few directories and a few hundred files under "root", named from a small alphabet so trigrams repeat
+    (none hidden, as the walkers skip names starting with ".")
+    return the relative path of every entry made
+*/
+vector<string> make_tree(const string &root)
+{
+    vector<string> paths = {"abc", "abc/cab", "b.a", "b.a/aa.b", "b.a/aa.b/c"};
+    for (const string &directory : vector<string>(paths))
+    {
+        CHECK(mkdir((root + "/" + directory).c_str(), 0755) == 0);
+    }
+
+    srand(33);
+    for (int i = 0; i < 300; i++)
+    {
+        string name(1, "abc"[rand() % 3]);
+        for (int k = rand() % 6; k > 0; k--)
+        {
+            name += "abc."[rand() % 4];
+        }
+        string path = paths[rand() % 5] + "/" + name + to_string(i % 7);
+        if (find(paths.begin(), paths.end(), path) != paths.end())
+        {
+            continue;
+        }
+
+        int fd = open((root + "/" + path).c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+        CHECK(fd != -1);
+        close(fd);
+        paths.push_back(path);
+    }
+    return paths;
+}
+
+// the paths of "index" holding "literal", by find_literal, sorted
+vector<string> indexed_paths(const TrigramIndex &index, const string &literal)
+{
+    vector<string> paths;
+    index.find_literal(literal, [&paths](const char *file, size_t length)
+                       { paths.push_back(string(file, length)); });
+    sort(paths.begin(), paths.end());
+    return paths;
+}
+
+// the paths of "all" holding "literal", by a scan with strstr, sorted
+vector<string> scanned_paths(const vector<string> &all, const string &literal)
+{
+    vector<string> paths;
+    for (const string &path : all)
+    {
+        if (strstr(path.c_str(), literal.c_str()) != nullptr)
+        {
+            paths.push_back(path);
+        }
+    }
+    sort(paths.begin(), paths.end());
+    return paths;
+}
+
+/*
+    TrigramIndex: every literal is found in the same paths as a scan of the tree finds it,
+    after the index is built, after the tree changes, and after the index file is damaged (it is rebuilt)
+*/
+void test_trigram_index()
+{
+    string directory = make_temporary_directory();
+    string root = directory + "/tree";
+    string file = directory + "/index";
+    CHECK(mkdir(root.c_str(), 0755) == 0);
+    vector<string> paths = make_tree(root);
+
+    const char *literals[] = {"", "a", ".", "ab", "c/", "abc", "b.a/", "aa.b/c", "a.b", "cab/c", "ccc", "abc/cab/", "zzz", "/b.a"};
+
+    // the listing of the index is the tree
+    TrigramIndex index;
+    CHECK(index.open(file, root) > 0);
+    CHECK(index.path_count() == paths.size());
+
+    vector<string> listed;
+    const char *end = index.listing_data() + index.listing_size();
+    Record entry;
+    for (const char *position = index.listing_data(); (position = read_record(position, end, entry)) != nullptr;)
+    {
+        listed.push_back(string(entry.name, entry.length));
+    }
+    sort(listed.begin(), listed.end());
+    CHECK(listed == scanned_paths(paths, ""));
+
+    for (const char *literal : literals)
+    {
+        CHECK(indexed_paths(index, literal) == scanned_paths(paths, literal));
+    }
+
+    // up to date: nothing listed again
+    TrigramIndex reopened;
+    CHECK(reopened.open(file, root) == 0);
+
+    // a file added, and one removed, are seen
+    CHECK(close(open((root + "/abc/cab/added.abc").c_str(), O_WRONLY | O_CREAT, 0644)) == 0);
+    paths.push_back("abc/cab/added.abc");
+    CHECK(unlink((root + "/" + paths[5]).c_str()) == 0);
+    paths.erase(paths.begin() + 5);
+
+    TrigramIndex updated;
+    CHECK(updated.open(file, root) > 0);
+    for (const char *literal : literals)
+    {
+        CHECK(indexed_paths(updated, literal) == scanned_paths(paths, literal));
+    }
+
+    // a damaged index is rebuilt: truncated, a path count past the file, a posting past the paths
+    string intact;
+    {
+        ifstream in(file, ios::binary);
+        intact.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    }
+
+    // the header is the magic, then 64-bit fields; the path count is the first, the offset of the postings the twelfth
+    uint64_t postings_offset;
+    memcpy(&postings_offset, intact.data() + 8 + 11 * 8, 8);
+    CHECK(postings_offset < intact.size());
+
+    vector<string> damaged(3, intact);
+    damaged[0].resize(intact.size() / 2);
+    memset(&damaged[1][8], 0x7f, 4);
+    memset(&damaged[2][postings_offset], 0xff, 4);
+
+    for (const string &bytes : damaged)
+    {
+        {
+            ofstream out(file, ios::binary | ios::trunc);
+            out.write(bytes.data(), bytes.size());
+        }
+
+        TrigramIndex rebuilt;
+        CHECK(rebuilt.open(file, root) > 0);
+        for (const char *literal : literals)
+        {
+            CHECK(indexed_paths(rebuilt, literal) == scanned_paths(paths, literal));
+        }
+    }
+
+    remove_tree(directory);
+}
+
+#ifdef HAVE_IO_URING
+// the name, type, inode and size of every record of "records", by name
+map<string, vector<uint64_t>> record_fields(const string &records)
+{
+    map<string, vector<uint64_t>> fields;
+    const char *end = records.data() + records.size();
+    Record entry;
+    for (const char *position = records.data(); (position = read_record(position, end, entry)) != nullptr;)
+    {
+        fields[string(entry.name, entry.length)] = {entry.type, entry.inode, entry.size};
+    }
+    return fields;
+}
+
+/*
+    UringWalker: the same records as DirectoryWalker, handed to a sink and written as frames through io_uring,
+    and no more than a few frames queued for a pipe read slowly
+    skipped where io_uring is not available
+*/
+void test_uring_walker()
+{
+    string directory = make_temporary_directory();
+    vector<string> paths = make_tree(directory);
+
+    const uint8_t fields = RECORD_INODE | RECORD_SIZE | RECORD_PARENT | RECORD_DIRECTORY_ID;
+
+    string expected;
+    DirectoryWalker walker(2, BUFFER_SIZE);
+    walker.set_record_fields(fields);
+    CHECK(walker.walk(directory, [&expected](const char *batch, size_t length)
+                      {
+        expected.append(batch, length);
+        return true; }));
+    CHECK(record_fields(expected).size() == paths.size());
+
+    UringWalker sink_walker(BUFFER_SIZE);
+    if (!sink_walker.setup())
+    {
+        printf("io_uring is not available (%s): UringWalker not tested\n", strerror(errno));
+        remove_tree(directory);
+        return;
+    }
+
+    string found;
+    sink_walker.set_record_fields(fields);
+    CHECK(sink_walker.walk(directory, [&found](const char *batch, size_t length)
+                           {
+        found.append(batch, length);
+        return true; }));
+    CHECK(sink_walker.error() == 0);
+    CHECK(record_fields(found) == record_fields(expected));
+
+    // the batches written as frames to a pipe, read back on another thread
+    int fd[2];
+    CHECK(pipe(fd) == 0);
+
+    string framed;
+    thread reader([&]
+                  {
+        FrameReader frames(fd[READ_END], BUFFER_SIZE);
+        const char *data;
+        size_t length;
+        while (frames.next(data, length) == 1)
+        {
+            framed.append(data, length);
+        } });
+
+    UringWalker frame_walker(BUFFER_SIZE);
+    CHECK(frame_walker.setup());
+    frame_walker.set_record_fields(fields);
+    frame_walker.write_frames_to(fd[WRITE_END]);
+    CHECK(frame_walker.walk(directory, [](const char *, size_t)
+                            { return true; }));
+    CHECK(frame_walker.error() == 0);
+    close(fd[WRITE_END]);
+
+    reader.join();
+    close(fd[READ_END]);
+    CHECK(record_fields(framed) == record_fields(expected));
+
+    remove_tree(directory);
+
+    // a large flat directory, read by a slow reader: the frames waiting for the pipe stay few, as they do for DirectoryWalker
+    directory = make_temporary_directory();
+    const size_t entry_count = 50000;
+    for (size_t i = 0; i < entry_count; i++)
+    {
+        CHECK(close(open((directory + "/entry_" + to_string(i)).c_str(), O_WRONLY | O_CREAT, 0644)) == 0);
+    }
+
+    CHECK(pipe(fd) == 0);
+    size_t entries_read = 0;
+    thread slow_reader([&]
+                       {
+        FrameReader frames(fd[READ_END], BUFFER_SIZE);
+        const char *data;
+        size_t length;
+        while (frames.next(data, length) == 1)
+        {
+            const char *end = data + length;
+            Record entry;
+            for (const char *position = data; (position = read_record(position, end, entry)) != nullptr;)
+            {
+                entries_read++;
+            }
+            usleep(200);
+        } });
+
+    UringWalker flat_walker(4096);
+    CHECK(flat_walker.setup());
+    flat_walker.write_frames_to(fd[WRITE_END]);
+    CHECK(flat_walker.walk(directory, [](const char *, size_t)
+                           { return true; }));
+    CHECK(flat_walker.error() == 0);
+    close(fd[WRITE_END]);
+
+    slow_reader.join();
+    close(fd[READ_END]);
+    CHECK(entries_read == entry_count);
+    CHECK(flat_walker.write_frames > 100);
+    // entries of a known type need no look-up, so no frame is added while completions are reaped
+    CHECK(flat_walker.most_frames_queued <= 4);
+
+    remove_tree(directory);
+}
+#endif
+
+/*
+    the transports of fan-out: a frame of a sequence number and the largest batch the walker makes
+    (just under BUFFER_SIZE, then a record with the longest name) goes through every one, even on the smallest ring
+*/
+void test_fan_out_transports()
+{
+    string batch;
+    Record record = {};
+    string name(200, 'f');
+    record.name = name.data();
+    while (batch.size() + RECORD_HEADER_SIZE + name.size() < size_t(BUFFER_SIZE) - 1)
+    {
+        record.length = name.size();
+        append_record(batch, record, "", 0);
+    }
+    record.length = BUFFER_SIZE - 1 - batch.size() - RECORD_HEADER_SIZE;
+    append_record(batch, record, "", 0);
+    CHECK(batch.size() == size_t(BUFFER_SIZE) - 1);
+
+    string longest(MAX_RECORD_NAME, 'l');
+    record.name = longest.data();
+    record.length = longest.size();
+    record.flags = RECORD_INODE | RECORD_SIZE | RECORD_PARENT | RECORD_DIRECTORY_ID;
+    CHECK(append_record(batch, record, "", 0));
+    CHECK(batch.size() == size_t(BUFFER_SIZE) - 1 + MAX_RECORD_SIZE);
+
+    SequenceNumber sequence = 12345;
+    string frame(reinterpret_cast<const char *>(&sequence), sizeof(sequence));
+    frame += batch;
+
+    for (const char *name : {"pipe", "socketpair", "splice", "shm"})
+    {
+        PipelineOptions options;
+        options.transport = name;
+        options.ring_capacity = 4096;
+
+        unique_ptr<Transport> transport(create_transport(options, sizeof(SequenceNumber)));
+        CHECK(transport && transport->open());
+        if (!transport)
+        {
+            continue;
+        }
+
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            transport->consumer_side();
+            const char *data;
+            size_t length;
+            bool received = transport->receive(data, length) == 1 && string(data, length) == frame;
+            bool ended = transport->receive(data, length) == 0;
+            exit(received && ended ? 0 : 1);
+        }
+
+        transport->producer_side();
+        char *reserved = transport->reserve(frame.size());
+        if (reserved == nullptr)
+        {
+            fprintf(stderr, "transport %s: %s\n", name, strerror(errno));
+        }
+        CHECK(reserved != nullptr);
+        if (reserved)
+        {
+            memcpy(reserved, frame.data(), frame.size());
+            CHECK(transport->commit(frame.size()));
+            CHECK(transport->finish());
+        }
+        transport.reset();
+
+        int status;
+        CHECK(waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+}
+
+// a result frame of fan-out: "sequence", then a hit of pattern 0 for each of "files"
+string result_frame(SequenceNumber sequence, const vector<string> &files)
+{
+    string results(reinterpret_cast<const char *>(&sequence), sizeof(sequence));
+    for (const string &file : files)
+    {
+        uint32_t hit[2] = {0, uint32_t(file.size())};
+        results.append(reinterpret_cast<const char *>(hit), sizeof(hit));
+        results += file;
+    }
+
+    string frame;
+    append_frame(frame, results.data(), results.size());
+    return frame;
+}
+
+/*
+    merge_results, in order: the batches come out in the order of the listing,
+    and a consumer that dies before its end mark fails the merge, with the batches held back behind its missing one still shown
+*/
+void test_merge_results()
+{
+    CustomGrep grep(vector<string>{"file"});
+    SequenceNumber done = CONSUMER_DONE;
+    string end_mark;
+    append_frame(end_mark, reinterpret_cast<const char *>(&done), sizeof(done));
+
+    for (bool dies : {false, true})
+    {
+        int first[2], second[2];
+        CHECK(pipe(first) == 0 && pipe(second) == 0);
+
+        // the first consumer got batches 1 and 2 (in two frames), the second batch 0, unless it died before sending it
+        string sent = result_frame(2, {"file_2"}) + result_frame(1 | MORE_RESULTS, {"file_1a"}) + result_frame(1, {"file_1b"}) + end_mark;
+        write_all(first[WRITE_END], sent.data(), sent.size());
+        if (!dies)
+        {
+            sent = result_frame(0, {"file_0"}) + end_mark;
+            write_all(second[WRITE_END], sent.data(), sent.size());
+        }
+        close(first[WRITE_END]);
+        close(second[WRITE_END]);
+
+        // the hits go to cout, and the reports of the failure to stderr
+        ostringstream displayed;
+        streambuf *saved = cout.rdbuf(displayed.rdbuf());
+        int saved_stderr = dup(STDERR_FILENO);
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, STDERR_FILENO);
+
+        bool merged = merge_results({first[READ_END], second[READ_END]}, true);
+
+        dup2(saved_stderr, STDERR_FILENO);
+        close(saved_stderr);
+        close(null_fd);
+        cout.rdbuf(saved);
+        close(first[READ_END]);
+        close(second[READ_END]);
+
+        string files = displayed.str();
+        size_t first_file = files.find("file_");
+        CHECK(merged == !dies);
+        CHECK(first_file != string::npos && files.substr(first_file) == string(dies ? "" : "file_0\n") + "file_1a\nfile_1b\nfile_2\n");
+    }
+}
+
+/*
+    serve_worker: a client that sends several queries at once and closes its side before reading
+    gets every one of them answered, though the answers pile up past EDGE_LIMIT before it reads any
+*/
+void test_serve_pipelined_queries()
+{
+    // a listing in which every path holds "file", so an answer is larger than EDGE_LIMIT
+    string records;
+    const size_t record_count = 40000;
+    for (size_t i = 0; i < record_count; i++)
+    {
+        string name = "dir/file_" + to_string(i);
+        Record record = {};
+        record.name = name.data();
+        record.length = name.size();
+        append_record(records, record, "", 0);
+    }
+
+    SharedListing listing;
+    listing.data = &records[0];
+    listing.length = records.size();
+    listing.records = record_count;
+
+    string directory = make_temporary_directory();
+    struct sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s/socket", directory.c_str());
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    CHECK(listen_fd != -1);
+    CHECK(bind(listen_fd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) == 0);
+    CHECK(listen(listen_fd, 4) == 0);
+
+    sigset_t mask;
+    sigprocmask(SIG_SETMASK, nullptr, &mask);
+    pid_t worker = fork();
+    if (worker == 0)
+    {
+        serve_worker(listen_fd, listing, mask);
+    }
+    close(listen_fd);
+
+    const int query_count = 3;
+    string request(1, QUERY_REQUEST);
+    request += "file";
+    request += '\0';
+    string requests;
+    for (int i = 0; i < query_count; i++)
+    {
+        append_frame(requests, request.data(), request.size());
+    }
+
+    // closing the own side at once, or keeping it open (and sending the end frame once answered)
+    int status;
+    for (bool half_close : {true, false})
+    {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        CHECK(connect(fd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) == 0);
+
+        // a worker that stalls fails the test, rather than hang it
+        struct timeval timeout = {5, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        CHECK(write_all(fd, requests.data(), requests.size()));
+        if (half_close)
+        {
+            CHECK(shutdown(fd, SHUT_WR) == 0);
+        }
+
+        // let the answers fill the socket and reach EDGE_LIMIT before reading them
+        usleep(100000);
+
+        FrameReader reader(fd, 2 * BUFFER_SIZE);
+        const char *data;
+        size_t length;
+        int answered = 0;
+        uint64_t matches = 0;
+        while ((half_close || answered < query_count) && (status = reader.next(data, length)) != -1)
+        {
+            // an end frame ends an answer; the stream goes on to the next one
+            if (status == 1 && data[0] == RESULT_STATS && length == 1 + sizeof(QueryStats))
+            {
+                QueryStats stats;
+                memcpy(&stats, data + 1, sizeof(stats));
+                matches += stats.matches;
+                answered++;
+            }
+        }
+
+        CHECK(answered == query_count);
+        CHECK(matches == query_count * record_count);
+        if (!half_close)
+        {
+            CHECK(write_end_frame(fd));
+        }
+        close(fd);
+    }
+
+    kill(worker, SIGTERM);
+    CHECK(waitpid(worker, &status, 0) == worker);
+    remove_tree(directory);
+}
+
+int main()
+{
+    signal(SIGPIPE, SIG_IGN);
+
+    test_frame_reader();
+    test_substring_kernels();
+    test_pattern_matcher();
+    test_records();
+    test_fan_out_transports();
+    test_merge_results();
+    test_serve_pipelined_queries();
+    test_trigram_index();
+#ifdef HAVE_IO_URING
+    test_uring_walker();
+#endif
+
+    if (failures > 0)
+    {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+
+    printf("all tests passed\n");
+    return 0;
+}